@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/aio_abi.h>
+
+/*
+ * queue-depth scaling check for async O_DIRECT reads (raw Linux AIO)
+ *
+ * run it at several queue depths through the seccontiofs mount and on
+ * the lower fs; IOPS through the mount should grow with the depth the
+ * same way they do below it:
+ *
+ *   check_aio_bench /srv/data/cont1/data.img 1
+ *   check_aio_bench /srv/data/cont1/data.img 128
+ *
+ * "nowait" as last argument submits with RWF_NOWAIT; -EAGAIN completions
+ * are counted and resubmitted without the flag, the way io_uring punts
+ * them to a worker
+ *
+ * usage: check_aio_bench <file> <qd> [nr_ios] [block_size] [nowait]
+ */
+
+#ifndef RWF_NOWAIT
+#define RWF_NOWAIT 0x00000008
+#endif
+
+#define MAX_QD 1024
+
+static inline unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline long next_off(long nr_blocks, size_t bs)
+{
+    return (random() % nr_blocks) * (long) bs;
+}
+
+int main(int cn, char **cv)
+{
+    int fd, i, qd, inflight = 0, rw_flags = 0;
+    long nr_ios = 100000, submitted = 0, completed = 0, nr_blocks;
+    long again = 0;
+    size_t bs = 4096;
+    struct stat st;
+    aio_context_t ctx = 0;
+    struct iocb *iocbs, *ptrs[MAX_QD];
+    struct io_event events[MAX_QD];
+    char *bufs;
+    unsigned long long start, elapsed;
+
+    if (cn < 3 || cn > 6)
+        return -1;
+
+    if (strcmp(cv[cn - 1], "nowait") == 0) {
+        rw_flags = RWF_NOWAIT;
+        cn--;
+    }
+
+    qd = atoi(cv[2]);
+    if (cn > 3)
+        nr_ios = strtol(cv[3], NULL, 10);
+    if (cn > 4)
+        bs = strtoul(cv[4], NULL, 10);
+    if (qd <= 0 || qd > MAX_QD || nr_ios <= 0 || bs == 0)
+        return -1;
+
+    fd = open(cv[1], O_RDONLY | O_DIRECT);
+    if (fd < 0) {
+        perror("open:");
+        return 1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) bs) {
+        fprintf(stderr, "%s: file too small\n", cv[1]);
+        return 1;
+    }
+    nr_blocks = st.st_size / bs;
+
+    iocbs = calloc(qd, sizeof(*iocbs));
+    if (!iocbs || posix_memalign((void **) &bufs, 4096, bs * qd)) {
+        perror("alloc");
+        return 1;
+    }
+
+    if (syscall(SYS_io_setup, qd, &ctx) < 0) {
+        perror("io_setup");
+        return 1;
+    }
+
+    start = now_ns();
+    while (completed < nr_ios) {
+        int n = 0, got, done = 0;
+
+        /* keep qd requests in flight */
+        for (i = 0; i < qd && inflight + n < qd && submitted + n < nr_ios; i++) {
+            struct iocb *cb = &iocbs[i];
+
+            if (cb->aio_data)
+                continue;
+            memset(cb, 0, sizeof(*cb));
+            cb->aio_data = 1;
+            cb->aio_fildes = fd;
+            cb->aio_lio_opcode = IOCB_CMD_PREAD;
+            cb->aio_buf = (unsigned long) (bufs + i * bs);
+            cb->aio_nbytes = bs;
+            cb->aio_offset = next_off(nr_blocks, bs);
+            cb->aio_rw_flags = rw_flags;
+            ptrs[n++] = cb;
+        }
+        if (n) {
+            if (syscall(SYS_io_submit, ctx, n, ptrs) != n) {
+                perror("io_submit");
+                return 1;
+            }
+            submitted += n;
+            inflight += n;
+        }
+
+        got = syscall(SYS_io_getevents, ctx, 1, qd, events, NULL);
+        if (got < 0) {
+            perror("io_getevents");
+            return 1;
+        }
+        for (i = 0; i < got; i++) {
+            struct iocb *cb = (struct iocb *) (unsigned long) events[i].obj;
+
+            if ((long long) events[i].res == -EAGAIN && cb->aio_rw_flags) {
+                /* would have blocked: reissue as a plain async read */
+                cb->aio_rw_flags = 0;
+                if (syscall(SYS_io_submit, ctx, 1, &cb) != 1) {
+                    perror("io_submit");
+                    return 1;
+                }
+                again++;
+                continue;
+            }
+            if ((long long) events[i].res != (long long) bs) {
+                fprintf(stderr, "read: %s\n", strerror(-(int) events[i].res));
+                return 1;
+            }
+            cb->aio_data = 0;
+            done++;
+        }
+        inflight -= done;
+        completed += done;
+    }
+    elapsed = now_ns() - start;
+
+    printf("%s: qd %d, %ld x %zu bytes, %.0f IOPS, %.1f us avg\n",
+           cv[1], qd, completed, bs, completed / (elapsed / 1e9),
+           (elapsed / 1e3) / completed * qd);
+    if (rw_flags)
+        printf("%s: %ld of %ld nowait reads would have blocked\n",
+               cv[1], again, completed);
+
+    syscall(SYS_io_destroy, ctx);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/fs.h>
+
+/*
+ * copy_file_range / FICLONE throughput check
+ *
+ * copy the same source through the seccontiofs mount and directly on the
+ * lower fs and compare the figures:
+ *
+ *   check_copy_range /srv/data/cont1/img.raw /srv/data/cont1/img.copy
+ *   check_copy_range /srv/data/lxc-base/rootfs/img.raw /srv/data/lxc-base/rootfs/img.copy
+ *
+ * pass "clone" as a third argument to use FICLONE instead
+ */
+
+static inline unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int cn, char **cv)
+{
+    int in, out, clone = 0;
+    struct stat st;
+    loff_t done = 0;
+    ssize_t ret = 0;
+    unsigned long long start, elapsed;
+
+    if (cn < 3 || cn > 4)
+        return -1;
+
+    if (cn == 4)
+        clone = (strcmp(cv[3], "clone") == 0);
+
+    in = open(cv[1], O_RDONLY);
+    if (in < 0) {
+        perror("open:");
+        return 1;
+    }
+    if (fstat(in, &st) < 0) {
+        perror("fstat");
+        return 1;
+    }
+    out = open(cv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        perror("open:");
+        return 1;
+    }
+
+    start = now_ns();
+    if (clone) {
+        ret = ioctl(out, FICLONE, in);
+        if (ret == 0)
+            done = st.st_size;
+    } else {
+        while (done < st.st_size) {
+            ret = copy_file_range(in, NULL, out, NULL, st.st_size - done, 0);
+            if (ret <= 0)
+                break;
+            done += ret;
+        }
+    }
+    elapsed = now_ns() - start;
+
+    if (ret < 0)
+        perror(clone ? "ioctl(FICLONE)" : "copy_file_range");
+
+    printf("%s: %lld bytes in %.3f ms, %.1f MiB/s\n", clone ? "clone" : "copy",
+           (long long) done, elapsed / 1e6,
+           elapsed ? (done / 1048576.0) / (elapsed / 1e9) : 0.0);
+
+    close(out);
+    close(in);
+
+    return ret < 0;
+}
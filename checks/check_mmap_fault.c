@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * page fault latency check
+ *
+ * maps the whole file, touches every page once and reports the time per
+ * fault; drop caches or pre-read the file the same way for both runs and
+ * compare the mount against the lower fs:
+ *
+ *   check_mmap_fault /srv/data/cont1/data.img
+ *   check_mmap_fault /srv/data/lxc-base/rootfs/data.img
+ *
+ * options (any order):
+ *   write     shared writable faults (page_mkwrite path)
+ *   hugepage  madvise(MADV_HUGEPAGE) before touching; the PMD-mapped
+ *             size is read back from /proc/self/smaps
+ *
+ * after the fault pass the mapping is read again at random pages; with
+ * the page tables populated that pass is dominated by TLB misses, so
+ * it shows whether huge mappings made it through the mount
+ */
+
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+
+/* FilePmdMapped of the vma at addr, in kB, or -1 */
+static long pmd_mapped_kb(unsigned long addr)
+{
+    FILE *f = fopen("/proc/self/smaps", "r");
+    char line[256];
+    unsigned long start, end;
+    long kb = -1;
+    int in_vma = 0;
+
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            in_vma = (addr >= start && addr < end);
+            continue;
+        }
+        if (in_vma && sscanf(line, "FilePmdMapped: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(f);
+    return kb;
+}
+
+static inline unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int cn, char **cv)
+{
+    int fd, i_arg, write = 0, hugepage = 0;
+    long pgsz = sysconf(_SC_PAGESIZE);
+    size_t i, nr_pages;
+    struct stat st;
+    struct rusage ru0, ru1;
+    volatile char *map;
+    long faults;
+    unsigned long long start, elapsed, random_ns;
+
+    if (cn < 2 || cn > 4)
+        return -1;
+
+    for (i_arg = 2; i_arg < cn; i_arg++) {
+        if (strcmp(cv[i_arg], "write") == 0)
+            write = 1;
+        else if (strcmp(cv[i_arg], "hugepage") == 0)
+            hugepage = 1;
+        else
+            return -1;
+    }
+
+    fd = open(cv[1], write ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        perror("open:");
+        return 1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < pgsz) {
+        fprintf(stderr, "%s: file too small\n", cv[1]);
+        return 1;
+    }
+    nr_pages = st.st_size / pgsz;
+
+    map = mmap(NULL, nr_pages * pgsz, write ? PROT_READ | PROT_WRITE : PROT_READ,
+               MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if (hugepage && madvise((void *) map, nr_pages * pgsz, MADV_HUGEPAGE) < 0)
+        perror("madvise(MADV_HUGEPAGE)");
+
+    getrusage(RUSAGE_SELF, &ru0);
+    start = now_ns();
+    for (i = 0; i < nr_pages; i++) {
+        if (write)
+            map[i * pgsz] = 1;
+        else
+            (void) map[i * pgsz];
+    }
+    elapsed = now_ns() - start;
+    getrusage(RUSAGE_SELF, &ru1);
+
+    faults = (ru1.ru_minflt - ru0.ru_minflt) + (ru1.ru_majflt - ru0.ru_majflt);
+    printf("%s: %zu pages, %ld faults (%ld major), %.1f ns/page, %.1f ns/fault\n",
+           cv[1], nr_pages, faults, ru1.ru_majflt - ru0.ru_majflt,
+           (double) elapsed / nr_pages,
+           faults ? (double) elapsed / faults : 0.0);
+
+    srandom(1);
+    start = now_ns();
+    for (i = 0; i < nr_pages; i++)
+        (void) map[(random() % nr_pages) * pgsz];
+    random_ns = now_ns() - start;
+
+    printf("%s: %.1f ns/random access, mapping %lu-aligned, %ld kB PMD-mapped\n",
+           cv[1], (double) random_ns / nr_pages,
+           ((unsigned long) map & ((2UL << 20) - 1)) ? 4096UL : 2UL << 20,
+           pmd_mapped_kb((unsigned long) map));
+
+    munmap((void *) map, nr_pages * pgsz);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * open/close latency microbenchmark
+ *
+ * run it against the same file through the seccontiofs mount and
+ * through the lower (base) fs and compare the ns/op figures:
+ *
+ *   check_open_bench /srv/data/cont1/etc/passwd 1000000
+ *   check_open_bench /srv/data/lxc-base/rootfs/etc/passwd 1000000
+ */
+
+static inline unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int cn, char **cv)
+{
+    int fd;
+    long i, loops = 100000;
+    unsigned long long start, elapsed;
+
+    if (cn < 2 || cn > 3)
+        return -1;
+
+    if (cn == 3)
+        loops = strtol(cv[2], NULL, 10);
+    if (loops <= 0)
+        return -1;
+
+    /* warm up dcache/icache so only the open path is measured */
+    fd = open(cv[1], O_RDONLY);
+    if (fd < 0) {
+        perror("open:");
+        return 1;
+    }
+    close(fd);
+
+    start = now_ns();
+    for (i = 0; i < loops; i++) {
+        fd = open(cv[1], O_RDONLY);
+        if (fd < 0) {
+            perror("open:");
+            return 1;
+        }
+        close(fd);
+    }
+    elapsed = now_ns() - start;
+
+    printf("%s: %ld open/close, %.1f ns/op\n",
+           cv[1], loops, (double) elapsed / loops);
+
+    return 0;
+}
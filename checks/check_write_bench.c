@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * buffered write + fsync throughput, for cgroup writeback fairness
+ *
+ * start one instance per container cgroup at the same time, each writing
+ * its own file through its own mount, and compare the MiB/s with the
+ * io.weight / io.max settings of the two groups:
+ *
+ *   echo "8:16 wbps=52428800" > /sys/fs/cgroup/cont1/io.max
+ *   cgexec -g io:cont1 check_write_bench /srv/data/cont1/big 2048 &
+ *   cgexec -g io:cont2 check_write_bench /srv/data/cont2/big 2048 &
+ *
+ * cont1 should stay near its limit and cont2 should get the rest, the
+ * same as when both write to the lower fs directly
+ *
+ * usage: check_write_bench <file> <MiB> [block_size]
+ */
+
+static inline unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int cn, char **cv)
+{
+    int fd;
+    size_t bs = 1 << 20;
+    long long total, done = 0;
+    char *buf;
+    unsigned long long start, dirtied, elapsed;
+
+    if (cn < 3 || cn > 4)
+        return -1;
+
+    total = strtoll(cv[2], NULL, 10) << 20;
+    if (cn == 4)
+        bs = strtoul(cv[3], NULL, 10);
+    if (total <= 0 || bs == 0)
+        return -1;
+
+    buf = malloc(bs);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    memset(buf, 0x5a, bs);
+
+    fd = open(cv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open:");
+        return 1;
+    }
+
+    start = now_ns();
+    while (done < total) {
+        ssize_t ret = write(fd, buf, bs);
+
+        if (ret < 0) {
+            perror("write");
+            return 1;
+        }
+        done += ret;
+    }
+    dirtied = now_ns() - start;
+    if (fsync(fd) < 0) {
+        perror("fsync");
+        return 1;
+    }
+    elapsed = now_ns() - start;
+
+    printf("%s: %lld MiB, dirtied in %.2f s, on disk in %.2f s, %.1f MiB/s\n",
+           cv[1], done >> 20, dirtied / 1e9, elapsed / 1e9,
+           (done / 1048576.0) / (elapsed / 1e9));
+
+    close(fd);
+    free(buf);
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include "seccontiofs.h"
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
+
+/*
+ * Audit events for the ControlApp.
+ *
+ * Every CPU has a ring of fixed-size records in a vmalloc_user() area
+ * that the (single) reader maps read-only.  Producers write with
+ * preemption off and publish by bumping the ring's head; a full ring
+ * drops the record and counts it, so capture never waits for the reader.
+ * The reader acks what it consumed with SECCONTIOFS_AUDIT_ACK and sleeps
+ * in poll(), which is only woken when a ring goes from empty to non-empty.
+ * While the device is closed capture is a static branch.
+ */
+
+#define SECCONTIOFS_AUDIT_PAGES	64	/* of records per CPU */
+
+DEFINE_STATIC_KEY_FALSE(seccontiofs_audit_on);
+
+static void *seccontiofs_audit_buf;
+static size_t seccontiofs_audit_stride;
+static DECLARE_WAIT_QUEUE_HEAD(seccontiofs_audit_wq);
+static atomic_t seccontiofs_audit_busy = ATOMIC_INIT(0);	/* one reader */
+
+static inline sciaudit_hdr *seccontiofs_audit_hdr(void *buf, int cpu)
+{
+	return buf + cpu * seccontiofs_audit_stride;
+}
+
+static inline sciaudit_rec *seccontiofs_audit_rec(sciaudit_hdr *hdr, u64 pos)
+{
+	return (void *)hdr + PAGE_SIZE +
+		(pos & (hdr->nr_records - 1)) * sizeof(sciaudit_rec);
+}
+
+void __seccontiofs_audit(int type, struct super_block *sb,
+			 struct inode *inode, const char *lbl, int arg,
+			 const char *old, int oldlen)
+{
+	sciaudit_hdr *hdr;
+	sciaudit_rec *rec;
+	void *buf;
+	u64 head;
+	bool wake;
+
+	preempt_disable();
+	buf = READ_ONCE(seccontiofs_audit_buf);
+	if (!buf)
+		goto out;
+	hdr = seccontiofs_audit_hdr(buf, smp_processor_id());
+	head = hdr->head;
+	if (head - smp_load_acquire(&hdr->tail) >= hdr->nr_records) {
+		hdr->dropped++;
+		goto out;
+	}
+	wake = head == hdr->tail;
+
+	rec = seccontiofs_audit_rec(hdr, head);
+	rec->ts_ns = ktime_get_ns();
+	rec->ino = inode ? inode->i_ino : 0;
+	/* the ControlApp reads these from the init pid namespace */
+	rec->pid = task_tgid_nr(current);
+	rec->dev = new_encode_dev(sb->s_dev);
+	rec->type = type;
+	rec->arg = arg;
+	memset(rec->label, 0, sizeof(rec->label));
+	if (lbl)
+		memcpy(rec->label, lbl, SECCONTIOFS_LABEL_LEN);
+	memset(rec->old, 0, sizeof(rec->old));
+	if (old)
+		memcpy(rec->old, old, min_t(int, oldlen, sizeof(rec->old)));
+	/* the record must be complete before the reader sees the head move */
+	smp_store_release(&hdr->head, head + 1);
+
+	/* orders the head store against the waitqueue check, see poll */
+	if (wake && wq_has_sleeper(&seccontiofs_audit_wq))
+		wake_up_interruptible(&seccontiofs_audit_wq);
+out:
+	preempt_enable();
+}
+
+static int seccontiofs_audit_open(struct inode *inode, struct file *file)
+{
+	size_t ring = SECCONTIOFS_AUDIT_PAGES * PAGE_SIZE;
+	sciaudit_hdr *hdr;
+	void *buf;
+	int cpu;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (atomic_cmpxchg(&seccontiofs_audit_busy, 0, 1))
+		return -EBUSY;
+
+	seccontiofs_audit_stride = PAGE_SIZE + ring;
+	buf = vmalloc_user(seccontiofs_audit_stride * nr_cpu_ids);
+	if (!buf) {
+		atomic_set(&seccontiofs_audit_busy, 0);
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu) {
+		hdr = seccontiofs_audit_hdr(buf, cpu);
+		hdr->nr_records = ring / sizeof(sciaudit_rec);
+		hdr->stride = seccontiofs_audit_stride;
+		hdr->nr_cpus = nr_cpu_ids;
+	}
+	WRITE_ONCE(seccontiofs_audit_buf, buf);
+	static_branch_enable(&seccontiofs_audit_on);
+	return 0;
+}
+
+static int seccontiofs_audit_release(struct inode *inode, struct file *file)
+{
+	void *buf = seccontiofs_audit_buf;
+
+	static_branch_disable(&seccontiofs_audit_on);
+	WRITE_ONCE(seccontiofs_audit_buf, NULL);
+	/* producers run with preemption off */
+	synchronize_sched();
+	vfree(buf);
+	atomic_set(&seccontiofs_audit_busy, 0);
+	return 0;
+}
+
+static int seccontiofs_audit_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, seccontiofs_audit_buf, vma->vm_pgoff);
+}
+
+static unsigned int seccontiofs_audit_poll(struct file *file, poll_table *wait)
+{
+	sciaudit_hdr *hdr;
+	int cpu;
+
+	poll_wait(file, &seccontiofs_audit_wq, wait);
+	/* pairs with wq_has_sleeper() in __seccontiofs_audit() */
+	smp_mb();
+	for_each_possible_cpu(cpu) {
+		hdr = seccontiofs_audit_hdr(seccontiofs_audit_buf, cpu);
+		if (smp_load_acquire(&hdr->head) != hdr->tail)
+			return POLLIN | POLLRDNORM;
+	}
+	return 0;
+}
+
+static long seccontiofs_audit_ioctl(struct file *file, unsigned int cmd,
+				    unsigned long arg)
+{
+	sciaudit_ack ack;
+	sciaudit_hdr *hdr;
+
+	if (cmd != SECCONTIOFS_AUDIT_ACK)
+		return -ENOTTY;
+	if (copy_from_user(&ack, (void __user *)arg, sizeof(ack)))
+		return -EFAULT;
+	if (ack.cpu >= nr_cpu_ids || !cpu_possible(ack.cpu))
+		return -EINVAL;
+
+	hdr = seccontiofs_audit_hdr(seccontiofs_audit_buf, ack.cpu);
+	if (ack.tail < hdr->tail || ack.tail > READ_ONCE(hdr->head))
+		return -EINVAL;
+	/* the reader is done with the records, the producer may reuse them */
+	smp_store_release(&hdr->tail, ack.tail);
+	return 0;
+}
+
+static const struct file_operations seccontiofs_audit_fops = {
+	.owner		= THIS_MODULE,
+	.open		= seccontiofs_audit_open,
+	.release	= seccontiofs_audit_release,
+	.mmap		= seccontiofs_audit_mmap,
+	.poll		= seccontiofs_audit_poll,
+	.unlocked_ioctl	= seccontiofs_audit_ioctl,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice seccontiofs_audit_dev = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= SECCONTIOFS_AUDIT_DEV,
+	.fops		= &seccontiofs_audit_fops,
+	.mode		= 0600,
+};
+
+int seccontiofs_init_audit(void)
+{
+	return misc_register(&seccontiofs_audit_dev);
+}
+
+void seccontiofs_destroy_audit(void)
+{
+	misc_deregister(&seccontiofs_audit_dev);
+}
@@ -27,6 +27,9 @@ out:
 
 static void seccontiofs_d_release(struct dentry *dentry)
 {
+	/* export aliases (and a failed mount's root) may have none */
+	if (!dentry->d_fsdata)
+		return;
 	/* release and reset the lower paths */
 	seccontiofs_put_reset_lower_path(dentry);
 	free_dentry_private_data(dentry);
@@ -1,47 +1,78 @@
 #include "seccontiofs.h"
 
-static ssize_t 
-seccontiofs_read(struct file *file, char __user * buf,
-		 size_t count, loff_t * ppos)
+/* file private data gets its own cache, charged to the opener's memcg */
+static struct kmem_cache *seccontiofs_file_info_cachep;
+
+/* lower kiocbs cloned for async I/O */
+static struct kmem_cache *seccontiofs_aio_req_cachep;
+
+/* finishes their completions in process context */
+static struct workqueue_struct *seccontiofs_aio_wq;
+
+int seccontiofs_init_file_cache(void)
 {
-	int		err;
-	struct file    *lower_file;
-	struct dentry  *dentry = file->f_path.dentry;
+	seccontiofs_file_info_cachep =
+		kmem_cache_create("seccontiofs_file_info",
+				  sizeof(struct seccontiofs_file_info),
+				  0, SLAB_ACCOUNT, NULL);
+	if (!seccontiofs_file_info_cachep)
+		return -ENOMEM;
 
-	lower_file = seccontiofs_lower_file(file);
-	err = vfs_read(lower_file, buf, count, ppos);
-	/* update our inode atime upon a successful lower read */
-	if (err >= 0)
-		fsstack_copy_attr_atime(d_inode(dentry),
-					file_inode(lower_file));
+	seccontiofs_aio_req_cachep =
+		kmem_cache_create("seccontiofs_aio_req",
+				  sizeof(struct seccontiofs_aio_req),
+				  0, SLAB_ACCOUNT, NULL);
+	if (!seccontiofs_aio_req_cachep)
+		return -ENOMEM;
+
+	/* write completions may be what reclaim waits for (loop over us) */
+	seccontiofs_aio_wq = alloc_workqueue("seccontiofs_aio",
+					     WQ_MEM_RECLAIM, 0);
 
-	return err;
+	return seccontiofs_aio_wq ? 0 : -ENOMEM;
 }
 
-static ssize_t 
-seccontiofs_write(struct file *file, const char __user * buf,
-		  size_t count, loff_t * ppos)
+void seccontiofs_destroy_file_cache(void)
 {
-	int		err;
+	if (seccontiofs_aio_wq)
+		destroy_workqueue(seccontiofs_aio_wq);
+	if (seccontiofs_aio_req_cachep)
+		kmem_cache_destroy(seccontiofs_aio_req_cachep);
+	if (seccontiofs_file_info_cachep)
+		kmem_cache_destroy(seccontiofs_file_info_cachep);
+}
 
-	struct file    *lower_file;
-	struct dentry  *dentry = file->f_path.dentry;
+/*
+ * Regular files opened for reading open their lower file on first real
+ * I/O, so open-fstat-close and lock-file patterns only pay for a lower
+ * path reference.  Returns the lower file or an ERR_PTR.
+ */
+struct file *seccontiofs_open_lower(struct file *file)
+{
+	struct seccontiofs_file_info *info = seccontiofs_F(file);
+	struct file *lower_file;
 
 	lower_file = seccontiofs_lower_file(file);
-	err = vfs_write(lower_file, buf, count, ppos);
-	/* update our inode times+sizes upon a successful lower write */
-	if (err >= 0) {
-		fsstack_copy_inode_size(d_inode(dentry),
-					file_inode(lower_file));
-		fsstack_copy_attr_times(d_inode(dentry),
-					file_inode(lower_file));
+	if (likely(lower_file))
+		return lower_file;
+
+	lower_file = dentry_open(&info->lower_path, file->f_flags, file->f_cred);
+	if (IS_ERR(lower_file))
+		return lower_file;
+
+	/* a concurrent first I/O may have beaten us to it */
+	if (cmpxchg(&info->lower_file, NULL, lower_file)) {
+		fput(lower_file);
+		lower_file = seccontiofs_lower_file(file);
 	}
-	return err;
+	return lower_file;
 }
 
 static int 
 seccontiofs_readdir(struct file *file, struct dir_context *ctx)
 {
+	u64 stat_start = seccontiofs_stat_start_file(file,
+						     SECCONTIOFS_OP_READDIR);
 	int		err;
 	struct file    *lower_file = NULL;
 	struct dentry  *dentry = file->f_path.dentry;
@@ -52,7 +83,8 @@ seccontiofs_readdir(struct file *file, struct dir_context *ctx)
 	if (err >= 0)		/* copy the atime */
 		fsstack_copy_attr_atime(d_inode(dentry),
 					file_inode(lower_file));
-	return err;
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_READDIR,
+				     stat_start, err);
 }
 
 static inline int __is_private(const char *lbl){
@@ -68,7 +100,6 @@ seccontiofs_toggle_mode(struct file *file, void *__user * arg)
 {
     long err = -ENOTTY;
     struct super_block *sb;
-	struct dentry *dentry = file->f_path.dentry;
     
     /**
      * NOTE: flush all pages from cache!
@@ -76,29 +107,96 @@ seccontiofs_toggle_mode(struct file *file, void *__user * arg)
     sb = file_inode(file)->i_sb;
     shrink_dcache_sb(sb);
     
-    _pr_info_tr("Processing Change Mode IOCTL call\n");
-    
-    if (__is_private(seccontiofs_D(dentry)->lbl)) {
-        _pr_info_tr("... Change Mode IOCTL call is blocked for %s\n", seccontiofs_D(dentry)->lbl);
+    if (__is_private(seccontiofs_F(file)->lbl)) {
+        trace_seccontiofs_mode_toggle(sb, seccontiofs_F(file)->lbl,
+                                      seccontiofs_SB(sb)->__mode, true);
+        seccontiofs_audit(SECCONTIOFS_AUDIT_TOGGLE, sb, NULL,
+                          seccontiofs_F(file)->lbl, 1, NULL, 0);
         return err;
     }
     
     seccontiofs_SB(sb)->__mode = ~seccontiofs_SB(sb)->__mode;
+    trace_seccontiofs_mode_toggle(sb, seccontiofs_F(file)->lbl,
+                                  seccontiofs_SB(sb)->__mode, false);
+    seccontiofs_audit(SECCONTIOFS_AUDIT_TOGGLE, sb, NULL,
+                      seccontiofs_F(file)->lbl, 0, NULL, 0);
     
     return 0;
 }
 
+static long
+seccontiofs_sync_ioctl(struct file *file, sciomsg __user *arg)
+{
+    sciomsg msg;
+    const char *lbl = seccontiofs_F(file)->lbl;
+    struct super_block *sb = file_inode(file)->i_sb;
+
+    if (copy_from_user(&msg, arg, sizeof(msg)))
+        return -EFAULT;
+    if (msg.len) {
+        if (msg.len != SECCONTIOFS_LABEL_LEN)
+            return -EINVAL;
+        /* flushing someone else's files is for the host only */
+        if ((!lbl || memcmp(msg.payload, lbl, SECCONTIOFS_LABEL_LEN)) &&
+            !capable(CAP_SYS_ADMIN))
+            return -EPERM;
+        lbl = (const char *)msg.payload;
+    }
+    return seccontiofs_sync_lbl(sb, seccontiofs_lbl_slot(lbl));
+}
+
+static long
+seccontiofs_throttle_ioctl(struct file *file, sciothrottle __user *arg)
+{
+    sciothrottle t;
+    int slot;
+
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+    if (copy_from_user(&t, arg, sizeof(t)))
+        return -EFAULT;
+    /* only the two labels have limits; don't throttle the unlabelled */
+    slot = seccontiofs_lbl_slot((const char *)t.label);
+    if (slot == SECCONTIOFS_SLOT_NONE)
+        return -EINVAL;
+    seccontiofs_set_throttle(file_inode(file)->i_sb, slot, t.bps, t.iops);
+    return 0;
+}
+
+static long
+seccontiofs_quota_ioctl(struct file *file, sciquota __user *arg)
+{
+    sciquota q;
+    int slot;
+
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+    if (copy_from_user(&q, arg, sizeof(q)))
+        return -EFAULT;
+    /* as for throttling, only the two labels have quotas */
+    slot = seccontiofs_lbl_slot((const char *)q.label);
+    if (slot == SECCONTIOFS_SLOT_NONE)
+        return -EINVAL;
+    seccontiofs_set_quota(file_inode(file)->i_sb, slot, q.bytes, q.inodes);
+    return 0;
+}
+
 static long 
 seccontiofs_unlocked_ioctl(struct file *file, unsigned int cmd,
 			   unsigned long arg)
 {
+	u64 stat_start = seccontiofs_stat_start_file(file,
+						     SECCONTIOFS_OP_IOCTL);
 	long		err = -ENOTTY;
 	struct file    *lower_file;
 
-	lower_file = seccontiofs_lower_file(file);
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_IOCTL,
+					     stat_start, PTR_ERR(lower_file));
 
     /* XXX: use vfs_ioctl if/when VFS exports it */
-    if (!lower_file || !lower_file->f_op)
+    if (!lower_file->f_op)
         goto out;
     
     void __user *argp = (void __user *)arg;
@@ -107,6 +205,15 @@ seccontiofs_unlocked_ioctl(struct file *file, unsigned int cmd,
         case SECCONTIOFS_IOCTL_IOMSG:
             err = seccontiofs_toggle_mode(file, argp);
             break;
+        case SECCONTIOFS_IOCTL_SYNC:
+            err = seccontiofs_sync_ioctl(file, argp);
+            break;
+        case SECCONTIOFS_IOCTL_THROTTLE:
+            err = seccontiofs_throttle_ioctl(file, argp);
+            break;
+        case SECCONTIOFS_IOCTL_QUOTA:
+            err = seccontiofs_quota_ioctl(file, argp);
+            break;
     }
 
     /* some ioctls can change inode attributes (EXT2_IOC_SETFLAGS) */
@@ -114,7 +221,8 @@ seccontiofs_unlocked_ioctl(struct file *file, unsigned int cmd,
 		fsstack_copy_attr_all(file_inode(file),
 				      file_inode(lower_file));
 out:
-	return err;
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_IOCTL,
+				     stat_start, err);
 }
 
 #ifdef CONFIG_COMPAT
@@ -126,112 +234,249 @@ seccontiofs_compat_ioctl(struct file *file, unsigned int cmd,
 }
 #endif
 
+/*
+ * Hand the vma over to the lower file: vm_file becomes the lower file and
+ * the lower ->mmap installs its own vm_ops, so faults, page_mkwrite and
+ * fault-around run against the lower mapping with nothing interposed.
+ */
 static int 
 seccontiofs_mmap(struct file *file, struct vm_area_struct *vma)
 {
+	u64 stat_start = seccontiofs_stat_start_file(file, SECCONTIOFS_OP_MMAP);
 	int		err = 0;
-	bool		willwrite;
 	struct file    *lower_file;
-	const struct vm_operations_struct *saved_vm_ops = NULL;
 
-	/* this might be deferred to mmap's writepage */
-	willwrite = ((vma->vm_flags | VM_SHARED | VM_WRITE) == vma->vm_flags);
-
-	/*
-	 * File systems which do not implement ->writepage may use generic_file_readonly_mmap as their ->mmap op.  If
-	 * you call generic_file_readonly_mmap with VM_WRITE, you'd get an -EINVAL. But we cannot call the lower ->mmap
-	 * op, so we can't tell that writeable mappings won't work.  Therefore, our only choice is to check if the
-	 * lower file system supports the ->writepage, and if not, return EINVAL (the same error that
-	 * generic_file_readonly_mmap returns in that case).
-	 */
-	lower_file = seccontiofs_lower_file(file);
-	if (willwrite && !lower_file->f_mapping->a_ops->writepage) {
-		err = -EINVAL;
-		printk(KERN_ERR "seccontiofs: lower file system does not "
-		       "support writeable mmap\n");
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file)) {
+		err = PTR_ERR(lower_file);
+		goto out;
+	}
+	if (!lower_file->f_op->mmap) {
+		err = -ENODEV;
 		goto out;
 	}
+	if (WARN_ON(file != vma->vm_file)) {
+		err = -EIO;
+		goto out;
+	}
+#ifdef VM_SYNC
 	/*
-	 * find and save lower vm_ops.
-	 * 
-	 * XXX: the VFS should have a cleaner way of finding the lower vm_ops
+	 * We accept MAP_SYNC on behalf of the lower file; a lower that
+	 * can't honor it would otherwise just ignore VM_SYNC.
 	 */
-	if (!seccontiofs_F(file)->lower_vm_ops) {
-		err = lower_file->f_op->mmap(lower_file, vma);
-		if (err) {
-			printk(KERN_ERR "seccontiofs: lower mmap failed %d\n", err);
-			goto out;
-		}
-		saved_vm_ops = vma->vm_ops;	/* save: came from lower ->mmap */
+	if ((vma->vm_flags & VM_SYNC) &&
+	    !(lower_file->f_op->mmap_supported_flags & MAP_SYNC)) {
+		err = -EOPNOTSUPP;
+		goto out;
 	}
+#endif
+
+	vma->vm_file = get_file(lower_file);
+	err = lower_file->f_op->mmap(lower_file, vma);
+	if (err) {
+		/* mmap_region() drops the upper file on its error path */
+		fput(lower_file);
+		goto out;
+	}
+	fput(file);
+	fsstack_copy_attr_atime(file_inode(file), file_inode(lower_file));
 	/*
-	 * Next 3 lines are all I need from generic_file_mmap.  I definitely don't want its test for ->readpage which
-	 * returns -ENOEXEC.
+	 * stores through the mapping are never seen by us: marked up front,
+	 * and kept by seccontiofs_sync_lbl() while the mapping is there
 	 */
-	file_accessed(file);
-	vma->vm_ops = &seccontiofs_vm_ops;
+	if ((vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) ==
+	    (VM_SHARED | VM_MAYWRITE))
+		seccontiofs_mark_dirty(file);
+out:
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_MMAP,
+				     stat_start, err);
+}
 
-	file->f_mapping->a_ops = &seccontiofs_aops;	/* set our aops */
-	if (!seccontiofs_F(file)->lower_vm_ops)	/* save for our ->fault */
-		seccontiofs_F(file)->lower_vm_ops = saved_vm_ops;
+/*
+ * Let the lower fs pick the address, so mappings it can back with huge
+ * pages (THP, DAX) come out PMD-aligned.
+ */
+static unsigned long
+seccontiofs_get_unmapped_area(struct file *file, unsigned long addr,
+			      unsigned long len, unsigned long pgoff,
+			      unsigned long flags)
+{
+	u64 stat_start = seccontiofs_stat_start_file(file,
+					SECCONTIOFS_OP_GET_UNMAPPED_AREA);
+	struct file    *lower_file;
+	unsigned long	ret;
 
-out:
-	return err;
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		ret = PTR_ERR(lower_file);
+	else if (lower_file->f_op->get_unmapped_area)
+		ret = lower_file->f_op->get_unmapped_area(lower_file, addr, len,
+							  pgoff, flags);
+	else
+		ret = current->mm->get_unmapped_area(file, addr, len, pgoff,
+						     flags);
+	/* an address, or an error in the top page */
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_GET_UNMAPPED_AREA,
+				     stat_start, (long)ret);
+}
+
+/* lower lease mirroring one of ours, see seccontiofs_setlease */
+static bool seccontiofs_lease_break(struct file_lock *fl)
+{
+	struct seccontiofs_file_info *info =
+		seccontiofs_F((struct file *)fl->fl_owner);
+
+	/* under the lower flc_lock: breaking ours may sleep */
+	schedule_work(&info->lease_break);
+	return false;
+}
+
+static void seccontiofs_lease_break_work(struct work_struct *work)
+{
+	struct seccontiofs_file_info *info =
+		container_of(work, struct seccontiofs_file_info, lease_break);
+
+	/* only marks our leases breaking; the mirror goes with them */
+	__break_lease(info->lease_inode, O_WRONLY | O_NONBLOCK, FL_LEASE);
+}
+
+static const struct lock_manager_operations seccontiofs_lease_mirror_ops = {
+	.lm_break	= seccontiofs_lease_break,
+	.lm_change	= lease_modify,
+};
+
+static int seccontiofs_lease_mirror(struct file *file,
+				    struct file *lower_file)
+{
+	struct seccontiofs_file_info *info = seccontiofs_F(file);
+	const struct cred *cred;
+	struct file_lock *fl;
+	int err;
+
+	/* a mirror already there (or timed out by a lower breaker) is reset */
+	fl = locks_alloc_lock();
+	if (!fl)
+		return -ENOMEM;
+	fl->fl_owner = file;
+	fl->fl_pid = current->tgid;
+	fl->fl_file = lower_file;
+	fl->fl_flags = FL_LEASE;
+	fl->fl_type = F_RDLCK;
+	fl->fl_end = OFFSET_MAX;
+	fl->fl_lmops = &seccontiofs_lease_mirror_ops;
+
+	info->lease_inode = file_inode(file);
+	err = vfs_setlease(lower_file, F_RDLCK, &fl, NULL);
+	if (fl)
+		locks_free_lock(fl);
+	if (err)
+		return err;
+	cred = get_current_cred();
+	if (cmpxchg(&info->lease_cred, NULL, cred))
+		put_cred(cred);
+	return 0;
+}
+
+/* drop the mirror as whoever set it, whoever closes the file */
+static void seccontiofs_lease_unmirror(struct file *file,
+				       struct file *lower_file)
+{
+	const struct cred *cred, *old_cred;
+
+	cred = xchg(&seccontiofs_F(file)->lease_cred, NULL);
+	if (!cred)
+		return;
+	old_cred = override_creds(cred);
+	vfs_setlease(lower_file, F_UNLCK, NULL, (void **)&file);
+	revert_creds(old_cred);
+	put_cred(cred);
 }
 
 static int 
 seccontiofs_open(struct inode *inode, struct file *file)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(inode,
+						      SECCONTIOFS_OP_OPEN);
 	int		err = 0;
 	struct file    *lower_file = NULL;
-	struct path	lower_path;
-	struct dentry *dentry = file->f_path.dentry;
+	struct super_block *sb = inode->i_sb;
+	struct seccontiofs_file_info *info;
+	bool eager;
 
-	/* don't open unhashed/deleted files */
-	if (d_unhashed(file->f_path.dentry)) {
+	/* don't open unhashed/deleted files (O_TMPFILE ones are born so) */
+	if (d_unhashed(file->f_path.dentry) && !(file->f_flags & __O_TMPFILE)) {
 		err = -ENOENT;
 		goto out_err;
 	}
-	file->private_data =
-		kzalloc(sizeof(struct seccontiofs_file_info), GFP_KERNEL);
-	if (!seccontiofs_F(file)) {
+	info = kmem_cache_zalloc(seccontiofs_file_info_cachep, GFP_KERNEL);
+	if (!info) {
 		err = -ENOMEM;
 		goto out_err;
 	}
-	/* open lower object and link seccontio's file struct to lower's */
-	seccontiofs_get_lower_path(file->f_path.dentry, &lower_path);
-	lower_file = dentry_open(&lower_path, file->f_flags, current_cred());
-	path_put(&lower_path);
-	if (IS_ERR(lower_file)) {
-		err = PTR_ERR(lower_file);
-		lower_file = seccontiofs_lower_file(file);
-		if (lower_file) {
-			seccontiofs_set_lower_file(file, NULL);
-			fput(lower_file);	/* fput calls dput for lower_dentry */
-		}
+	file->private_data = info;
+	INIT_WORK(&info->lease_break, seccontiofs_lease_break_work);
+
+	/*
+	 * Pin the lower path; the lower file itself is only opened here for
+	 * directories, O_DIRECT opens (so an unsupported lower still fails
+	 * the open) and writers (so EROFS, ETXTBSY and the LSM's word come
+	 * from open() and the lower i_writecount is held from now on).
+	 * Readers otherwise defer it to their first I/O; their access was
+	 * checked on the lower inode by ->permission already, and a write
+	 * lease on it is broken here as the lower open would have.  Where
+	 * the VFS has nowait I/O, only the lower file can tell whether we
+	 * may offer it, so it is always opened here.
+	 */
+	seccontiofs_get_lower_path(file->f_path.dentry, &info->lower_path);
+	eager = !S_ISREG(inode->i_mode) || (file->f_mode & FMODE_WRITE) ||
+		(file->f_flags & O_DIRECT);
+#ifdef SECCONTIOFS_HAVE_NOWAIT
+	eager = true;
+#endif
+	if (eager) {
+		lower_file = seccontiofs_open_lower(file);
+		err = PTR_ERR_OR_ZERO(lower_file);
 	} else {
-		seccontiofs_set_lower_file(file, lower_file);
+		err = break_lease(seccontiofs_lower_inode(inode),
+				  file->f_flags);
 	}
+	if (err) {
+		path_put(&info->lower_path);
+		file->private_data = NULL;
+		kmem_cache_free(seccontiofs_file_info_cachep, info);
+		goto out_err;
+	}
+	fsstack_copy_attr_all(inode, seccontiofs_lower_inode(inode));
 
-	if (err)
-		kfree(seccontiofs_F(file));
-	else
-		fsstack_copy_attr_all(inode, seccontiofs_lower_inode(inode));
-
-	const char *SB_L = seccontiofs_SB(file_inode(file)->i_sb)->lbl;
+#ifdef SECCONTIOFS_HAVE_NOWAIT
+	/* RWF_NOWAIT and io_uring inline issue, as far as the lower takes them */
+	if (S_ISREG(inode->i_mode) && (lower_file->f_mode & FMODE_NOWAIT))
+		file->f_mode |= FMODE_NOWAIT;
+#endif
 
-    seccontiofs_D(dentry)->lbl = SB_L ?  SB_L : cg_to_lable(current);
+	/* resolve the label once; ioctls and accounting reuse it */
+	info->lbl = seccontiofs_cur_lbl(sb);
+	info->slot = seccontiofs_lbl_slot(info->lbl);
+	info->__mode = seccontiofs_SB(sb)->__mode;
+	percpu_counter_inc(&seccontiofs_usage(sb, info->slot)->files);
 
-    printk(KERN_INFO "%s @ %s\n", current->comm, seccontiofs_D(dentry)->lbl);
+	trace_seccontiofs_label(sb, inode, info->lbl);
+	seccontiofs_audit(SECCONTIOFS_AUDIT_OPEN, sb, inode, info->lbl, 0,
+			  NULL, 0);
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_OPEN,
+				     stat_start, 0);
 
 out_err:
-    seccontiofs_F(file)->__mode = seccontiofs_SB(file_inode(file)->i_sb);
-	return err;
+	/* no label resolved yet: a failed open counts for the inode's */
+	return seccontiofs_stat_inode(inode, SECCONTIOFS_OP_OPEN,
+				      stat_start, err);
 }
 
 static int 
 seccontiofs_flush(struct file *file, fl_owner_t id)
 {
+	u64 stat_start = seccontiofs_stat_start_file(file,
+						     SECCONTIOFS_OP_FLUSH);
 	int		err = 0;
 	struct file    *lower_file = NULL;
 
@@ -240,55 +485,194 @@ seccontiofs_flush(struct file *file, fl_owner_t id)
 		filemap_write_and_wait(file->f_mapping);
 		err = lower_file->f_op->flush(lower_file, id);
 	}
-	return err;
+	/* our POSIX locks live on the lower file, see seccontiofs_lock */
+	if (lower_file)
+		locks_remove_posix(lower_file, id);
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_FLUSH,
+				     stat_start, err);
+}
+
+/*
+ * OFD locks and flocks are owned by our file but set on the lower one;
+ * drop them here rather than whenever the last lower reference (an mmap,
+ * an aio in flight) goes away.  Our leases are dropped by the VFS, their
+ * lower mirror by seccontiofs_file_release.
+ */
+static void seccontiofs_release_locks(struct file *file,
+				      struct file *lower_file)
+{
+	struct file_lock fl = {
+		.fl_owner = file,
+		.fl_pid = current->tgid,
+		.fl_file = lower_file,
+		.fl_flags = FL_FLOCK,
+		.fl_type = F_UNLCK,
+		.fl_end = OFFSET_MAX,
+	};
+
+	if (!READ_ONCE(file_inode(lower_file)->i_flctx))
+		return;
+
+	locks_remove_posix(lower_file, file);
+	if (lower_file->f_op->flock)
+		lower_file->f_op->flock(lower_file, F_SETLKW, &fl);
+	else
+		locks_lock_file_wait(lower_file, &fl);
 }
 
 /* release all lower object references & free the file info structure */
 static int 
 seccontiofs_file_release(struct inode *inode, struct file *file)
 {
+	u64 stat_start = seccontiofs_stat_start_file(file,
+						     SECCONTIOFS_OP_RELEASE);
+	int		slot = seccontiofs_F(file)->slot;
 	struct file    *lower_file;
 
 	lower_file = seccontiofs_lower_file(file);
 	if (lower_file) {
+		seccontiofs_release_locks(file, lower_file);
+		seccontiofs_lease_unmirror(file, lower_file);
+		cancel_work_sync(&seccontiofs_F(file)->lease_break);
 		seccontiofs_set_lower_file(file, NULL);
 		fput(lower_file);
 	}
-	kfree(seccontiofs_F(file));
-	return 0;
+	path_put(&seccontiofs_F(file)->lower_path);
+	percpu_counter_dec(&seccontiofs_usage(inode->i_sb, slot)->files);
+	kmem_cache_free(seccontiofs_file_info_cachep, seccontiofs_F(file));
+	return seccontiofs_stat(inode->i_sb, slot, SECCONTIOFS_OP_RELEASE,
+				stat_start, 0);
 }
 
 static int 
 seccontiofs_fsync(struct file *file, loff_t start, loff_t end,
 		  int datasync)
 {
-	int		err;
+	u64 stat_start = seccontiofs_stat_start_file(file,
+						     SECCONTIOFS_OP_FSYNC);
 	struct file    *lower_file;
-	struct path	lower_path;
-	struct dentry  *dentry = file->f_path.dentry;
+	int		err;
 
-	err = __generic_file_fsync(file, start, end, datasync);
-	if (err)
-		goto out;
-	lower_file = seccontiofs_lower_file(file);
-	seccontiofs_get_lower_path(dentry, &lower_path);
+	/* our mapping never holds pages and our inode is never dirty */
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_FSYNC,
+					     stat_start, PTR_ERR(lower_file));
 	err = vfs_fsync_range(lower_file, start, end, datasync);
-	seccontiofs_put_lower_path(dentry, &lower_path);
-out:
-	return err;
+	/* delayed allocation and mmap writes show up in i_blocks by now */
+	seccontiofs_quota_update(file);
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_FSYNC,
+				     stat_start, err);
 }
 
 static int 
 seccontiofs_fasync(int fd, struct file *file, int flag)
 {
+	u64 stat_start = seccontiofs_stat_start_file(file,
+						     SECCONTIOFS_OP_FASYNC);
 	int		err = 0;
 	struct file    *lower_file = NULL;
 
-	lower_file = seccontiofs_lower_file(file);
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_FASYNC,
+					     stat_start, PTR_ERR(lower_file));
 	if (lower_file->f_op && lower_file->f_op->fasync)
 		err = lower_file->f_op->fasync(fd, lower_file, flag);
 
-	return err;
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_FASYNC,
+				     stat_start, err);
+}
+
+/*
+ * Locks are set on the lower file, so they are seen by the lower fs and
+ * by every other opener of the lower inode.  The request keeps its owner;
+ * only fl_file points below while it is processed.
+ */
+static int
+seccontiofs_lock(struct file *file, int cmd, struct file_lock *fl)
+{
+	u64 stat_start = seccontiofs_stat_start_file(file, SECCONTIOFS_OP_LOCK);
+	int		err;
+	struct file    *lower_file;
+
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_LOCK,
+					     stat_start, PTR_ERR(lower_file));
+
+	fl->fl_file = lower_file;
+	if (IS_GETLK(cmd))
+		err = vfs_test_lock(lower_file, fl);
+	else
+		err = vfs_lock_file(lower_file, cmd, fl, NULL);
+	fl->fl_file = file;
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_LOCK,
+				     stat_start, err);
+}
+
+static int
+seccontiofs_flock(struct file *file, int cmd, struct file_lock *fl)
+{
+	u64 stat_start = seccontiofs_stat_start_file(file, SECCONTIOFS_OP_LOCK);
+	int		err;
+	struct file    *lower_file;
+
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_LOCK,
+					     stat_start, PTR_ERR(lower_file));
+
+	fl->fl_file = lower_file;
+	if (lower_file->f_op->flock)
+		err = lower_file->f_op->flock(lower_file, cmd, fl);
+	else
+		err = locks_lock_file_wait(lower_file, fl);
+	fl->fl_file = file;
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_LOCK,
+				     stat_start, err);
+}
+
+/*
+ * Leases, unlike locks, stay on our file: F_GETLEASE, F_SETSIG and the
+ * break notification all go by the upper file and inode, and the VFS
+ * drops them at close.  So that opens for write and truncates of the
+ * lower inode beside us break them too, a lease of ours is mirrored by a
+ * read lease on the lower file; a write lease of ours can't be mirrored
+ * by one (our own lower references count as opens), and lower readers
+ * don't break it.  A break of the mirror is passed on to our inode.
+ */
+static int
+seccontiofs_setlease(struct file *file, long arg, struct file_lock **flp,
+		     void **priv)
+{
+	u64 stat_start = seccontiofs_stat_start_file(file, SECCONTIOFS_OP_LOCK);
+	int		err;
+	struct file    *lower_file;
+	bool		mirrored;
+
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_LOCK,
+					     stat_start, PTR_ERR(lower_file));
+
+	if (arg == F_UNLCK) {
+		err = generic_setlease(file, arg, flp, priv);
+		seccontiofs_lease_unmirror(file, lower_file);
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_LOCK,
+					     stat_start, err);
+	}
+
+	mirrored = READ_ONCE(seccontiofs_F(file)->lease_cred);
+	err = seccontiofs_lease_mirror(file, lower_file);
+	if (err)
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_LOCK,
+					     stat_start, err);
+	err = generic_setlease(file, arg, flp, priv);
+	if (err && !mirrored)
+		seccontiofs_lease_unmirror(file, lower_file);
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_LOCK,
+				     stat_start, err);
 }
 
 /*
@@ -298,6 +682,8 @@ seccontiofs_fasync(int fd, struct file *file, int flag)
 static loff_t 
 seccontiofs_file_llseek(struct file *file, loff_t offset, int whence)
 {
+	u64 stat_start = seccontiofs_stat_start_file(file,
+						     SECCONTIOFS_OP_LLSEEK);
 	int		err;
 	struct file    *lower_file;
 
@@ -309,82 +695,689 @@ seccontiofs_file_llseek(struct file *file, loff_t offset, int whence)
 	err = generic_file_llseek(lower_file, offset, whence);
 
 out:
-	return err;
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_LLSEEK,
+				     stat_start, err);
+}
+
+/*
+ * Regular files keep their offset in the upper file only (I/O goes by
+ * ki_pos), but SEEK_DATA/SEEK_HOLE need the lower fs's view of extents.
+ */
+static loff_t
+seccontiofs_main_llseek(struct file *file, loff_t offset, int whence)
+{
+	u64 stat_start = seccontiofs_stat_start_file(file,
+						     SECCONTIOFS_OP_LLSEEK);
+	loff_t		ret;
+	struct inode   *inode = file_inode(file);
+	struct file    *lower_file;
+
+	/* SEEK_END and friends must see writes done below us */
+	fsstack_copy_inode_size(inode, seccontiofs_lower_inode(inode));
+	if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+		ret = generic_file_llseek(file, offset, whence);
+		goto out;
+	}
+
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file)) {
+		ret = PTR_ERR(lower_file);
+		goto out;
+	}
+	ret = vfs_llseek(lower_file, offset, whence);
+	if (ret >= 0)
+		ret = vfs_setpos(file, ret, inode->i_sb->s_maxbytes);
+out:
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_LLSEEK,
+				     stat_start, ret);
+}
+
+static long
+seccontiofs_fallocate(struct file *file, int mode, loff_t offset, loff_t len)
+{
+	u64 stat_start = seccontiofs_stat_start_file(file,
+						     SECCONTIOFS_OP_FALLOCATE);
+	long		err;
+	struct file    *lower_file;
+
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file)) {
+		err = PTR_ERR(lower_file);
+		goto out;
+	}
+	/* giving space back is always allowed */
+	if (!(mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_COLLAPSE_RANGE))) {
+		err = seccontiofs_quota_check(file);
+		if (err)
+			goto out;
+	}
+	err = vfs_fallocate(lower_file, mode, offset, len);
+	seccontiofs_mark_dirty(file);
+	/* preallocation, punch-hole and zero/collapse-range may move i_size */
+	if (!err) {
+		fsstack_copy_inode_size(file_inode(file),
+					file_inode(lower_file));
+		fsstack_copy_attr_times(file_inode(file),
+					file_inode(lower_file));
+	}
+	seccontiofs_quota_update(file);
+out:
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_FALLOCATE,
+				     stat_start, err);
+}
+
+/*
+ * Async kiocbs are never handed down with a swapped ki_filp: the lower fs
+ * may complete them long after we returned -EIOCBQUEUED.  Instead the
+ * lower fs gets a clone with its own completion, which refreshes the upper
+ * inode once the I/O is really done, drops the lower file reference and
+ * only then completes the upper kiocb.  Like the sync path, a transfer
+ * that moved data is reported to fsnotify.
+ */
+static void seccontiofs_aio_cleanup(struct seccontiofs_aio_req *req, long res)
+{
+	struct kiocb *orig_iocb = req->orig_iocb;
+	struct file *lower_file = req->iocb.ki_filp;
+	struct inode *inode = file_inode(orig_iocb->ki_filp);
+
+	orig_iocb->ki_pos = req->iocb.ki_pos;
+	if (req->write) {
+		if (res > 0)
+			fsnotify_modify(lower_file);
+		fsstack_copy_inode_size(inode, file_inode(lower_file));
+		fsstack_copy_attr_times(inode, file_inode(lower_file));
+		seccontiofs_mark_dirty(orig_iocb->ki_filp);
+		seccontiofs_quota_update(orig_iocb->ki_filp);
+	} else {
+		if (res > 0)
+			fsnotify_access(lower_file);
+		fsstack_copy_attr_atime(inode, file_inode(lower_file));
+	}
+	fput(lower_file);
+	kmem_cache_free(seccontiofs_aio_req_cachep, req);
+}
+
+/* the lower kiocb is done: clean up, then complete the upper one */
+static void seccontiofs_aio_finish(struct seccontiofs_aio_req *req,
+				   long res, long res2)
+{
+	struct kiocb *orig_iocb = req->orig_iocb;
+
+	seccontiofs_aio_cleanup(req, res);
+	orig_iocb->ki_complete(orig_iocb, res, res2);
+}
+
+static void seccontiofs_aio_complete_work(struct work_struct *work)
+{
+	struct seccontiofs_aio_req *req =
+		container_of(work, struct seccontiofs_aio_req, work);
+
+	seccontiofs_aio_finish(req, req->res, req->res2);
+}
+
+/*
+ * Lower ->ki_complete, typically called from a block completion in irq
+ * or softirq context.  i_lock, quota and fsnotify want process context,
+ * so the rest is left to a worker, as overlayfs does.
+ */
+static void seccontiofs_aio_complete(struct kiocb *iocb, long res, long res2)
+{
+	struct seccontiofs_aio_req *req =
+		container_of(iocb, struct seccontiofs_aio_req, iocb);
+
+	req->res = res;
+	req->res2 = res2;
+	INIT_WORK(&req->work, seccontiofs_aio_complete_work);
+	queue_work(seccontiofs_aio_wq, &req->work);
+}
+
+static struct seccontiofs_aio_req *
+seccontiofs_aio_req_alloc(struct kiocb *iocb, struct file *lower_file,
+			  bool write)
+{
+	struct seccontiofs_aio_req *req;
+
+	req = kmem_cache_zalloc(seccontiofs_aio_req_cachep, GFP_KERNEL);
+	if (!req)
+		return NULL;
+
+	req->orig_iocb = iocb;
+	req->write = write;
+	req->iocb.ki_filp = get_file(lower_file);
+	req->iocb.ki_pos = iocb->ki_pos;
+	/*
+	 * Nobody would poll a cloned kiocb for completion, so a polled
+	 * request must not reach the lower device as one.
+	 */
+	req->iocb.ki_flags = iocb->ki_flags & ~IOCB_HIPRI;
+	req->iocb.ki_complete = seccontiofs_aio_complete;
+	return req;
+}
+
+/*
+ * Lower file for an iter request.  Our FMODE_NOWAIT is the lower file's,
+ * opened with ours; should an IOCB_NOWAIT caller find it missing anyway,
+ * it is told to retry blocking rather than that nowait is unsupported.
+ */
+static struct file *seccontiofs_iocb_lower(struct kiocb *iocb)
+{
+#ifdef SECCONTIOFS_HAVE_NOWAIT
+	struct file *lower_file;
+
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		lower_file = seccontiofs_lower_file(iocb->ki_filp);
+		if (!lower_file || !(lower_file->f_mode & FMODE_NOWAIT))
+			return ERR_PTR(-EAGAIN);
+		return lower_file;
+	}
+#endif
+	return seccontiofs_open_lower(iocb->ki_filp);
+}
+
+#ifdef SECCONTIOFS_HAVE_FADVISE
+static int seccontiofs_fadvise(struct file *file, loff_t offset, loff_t len,
+			       int advice)
+{
+	u64 stat_start = seccontiofs_stat_start_file(file,
+						     SECCONTIOFS_OP_FADVISE);
+	struct file    *lower_file;
+
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_FADVISE,
+					     stat_start, PTR_ERR(lower_file));
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_FADVISE, stat_start,
+				     vfs_fadvise(lower_file, offset, len,
+						 advice));
+}
+
+static inline void seccontiofs_sync_ra(struct file *file,
+				       struct file *lower_file)
+{
+}
+#else
+/*
+ * fadvise(NORMAL/SEQUENTIAL/RANDOM) only sets up our own file's readahead
+ * state, but the page cache it is meant for is the lower one.  Carry it
+ * over before reading.  WILLNEED is forwarded by seccontiofs_readpages.
+ */
+static inline void seccontiofs_sync_ra(struct file *file,
+				       struct file *lower_file)
+{
+	if (unlikely((file->f_mode ^ lower_file->f_mode) & FMODE_RANDOM)) {
+		spin_lock(&lower_file->f_lock);
+		lower_file->f_mode ^= FMODE_RANDOM;
+		spin_unlock(&lower_file->f_lock);
+	}
+	if (unlikely(lower_file->f_ra.ra_pages != file->f_ra.ra_pages))
+		lower_file->f_ra.ra_pages = file->f_ra.ra_pages;
+}
+#endif
+
+/*
+ * Submit an async request held back by the label's I/O limit.  We run in
+ * a worker, so borrow the submitter's mm and creds for the lower fs; the
+ * request may be completed and freed before the lower call returns.
+ */
+void seccontiofs_aio_submit(struct seccontiofs_aio_req *req)
+{
+	struct file *lower_file = req->iocb.ki_filp;
+	struct mm_struct *mm = req->mm;
+	const struct cred *cred = req->cred, *old_cred;
+	const void *iov = req->iov;
+	ssize_t ret;
+
+	old_cred = override_creds(cred);
+	if (mm)
+		use_mm(mm);
+	if (req->write) {
+		file_start_write(lower_file);
+		ret = lower_file->f_op->write_iter(&req->iocb, &req->iter);
+		file_end_write(lower_file);
+	} else {
+		ret = lower_file->f_op->read_iter(&req->iocb, &req->iter);
+	}
+	if (mm)
+		unuse_mm(mm);
+	revert_creds(old_cred);
+	if (ret != -EIOCBQUEUED)
+		seccontiofs_aio_finish(req, ret, 0);
+
+	if (mm)
+		mmput(mm);
+	put_cred(cred);
+	kfree(iov);
+}
+
+static int seccontiofs_aio_defer(struct file *file,
+				 struct seccontiofs_aio_req *req,
+				 struct iov_iter *iter, u64 wait)
+{
+	/* the caller's iovec array is gone once we return */
+	req->iov = dup_iter(&req->iter, iter, GFP_KERNEL);
+	if (!req->iov)
+		return -ENOMEM;
+	/* kernel submitters (loop) come with kernel buffers and no mm */
+	req->mm = current->mm;
+	if (req->mm)
+		atomic_inc(&req->mm->mm_users);
+	req->cred = get_current_cred();
+	seccontiofs_throttle_defer(file, req, wait);
+	return -EIOCBQUEUED;
+}
+
+/* charge the label's I/O limit; returns the wait or -EAGAIN for nowait */
+static inline s64 seccontiofs_iocb_throttle(struct kiocb *iocb,
+					    struct iov_iter *iter)
+{
+#ifdef SECCONTIOFS_HAVE_NOWAIT
+	if ((iocb->ki_flags & IOCB_NOWAIT) &&
+	    seccontiofs_throttle_busy(iocb->ki_filp))
+		return -EAGAIN;
+#endif
+	return seccontiofs_throttle(iocb->ki_filp, iov_iter_count(iter));
+}
+
+/*
+ * The check open_check_o_direct() makes, for O_DIRECT set after open.
+ * DAX files bypass the page cache whatever their aops say.
+ */
+static inline bool seccontiofs_lower_direct_ok(struct file *lower_file)
+{
+	if (IS_DAX(file_inode(lower_file)))
+		return true;
+	return lower_file->f_mapping->a_ops &&
+		lower_file->f_mapping->a_ops->direct_IO;
 }
 
 /*
  * seccontiofs read_iter, redirect modified iocb to lower read_iter
+ *
+ * This is the only read path: plain read(2) comes here through
+ * new_sync_read(), so IOCB_DIRECT from the upper file reaches the lower
+ * fs and its alignment rules apply unchanged.
  */
 ssize_t
 seccontiofs_read_iter(struct kiocb *iocb, struct iov_iter *iter)
 {
-	int		err;
 	struct file    *file = iocb->ki_filp, *lower_file;
+	/* once an async request is queued, @file may go before we return */
+	struct super_block *sb = file_inode(file)->i_sb;
+	int		slot = seccontiofs_F(file)->slot;
+	u64 stat_start = seccontiofs_stat_start(sb, slot, SECCONTIOFS_OP_READ);
+	ssize_t		err;
+	struct seccontiofs_aio_req *req;
+	s64		wait;
 
-	lower_file = seccontiofs_lower_file(file);
+	lower_file = seccontiofs_iocb_lower(iocb);
+	if (IS_ERR(lower_file)) {
+		err = PTR_ERR(lower_file);
+		goto out;
+	}
+	seccontiofs_sync_ra(file, lower_file);
 	if (!lower_file->f_op->read_iter) {
 		err = -EINVAL;
 		goto out;
 	}
+	if ((iocb->ki_flags & IOCB_DIRECT) &&
+	    !seccontiofs_lower_direct_ok(lower_file)) {
+		err = -EINVAL;
+		goto out;
+	}
+	err = security_file_permission(lower_file, MAY_READ);
+	if (err)
+		goto out;
+	wait = seccontiofs_iocb_throttle(iocb, iter);
+	if (wait < 0) {
+		err = wait;
+		goto out;
+	}
+
+	if (!is_sync_kiocb(iocb)) {
+		req = seccontiofs_aio_req_alloc(iocb, lower_file, false);
+		if (!req) {
+			err = -ENOMEM;
+			goto out;
+		}
+		if (wait) {
+			err = seccontiofs_aio_defer(file, req, iter, wait);
+			if (err != -EIOCBQUEUED)
+				seccontiofs_aio_cleanup(req, err);
+			goto out;
+		}
+		err = lower_file->f_op->read_iter(&req->iocb, iter);
+		if (err != -EIOCBQUEUED)
+			seccontiofs_aio_cleanup(req, err);
+		goto out;
+	}
+
+	err = seccontiofs_throttle_wait(wait);
+	if (err)
+		goto out;
+
 	get_file(lower_file);	/* prevent lower_file from being released */
 	iocb->ki_filp = lower_file;
 	err = lower_file->f_op->read_iter(iocb, iter);
 	iocb->ki_filp = file;
 	fput(lower_file);
+	if (err > 0)
+		fsnotify_access(lower_file);
 	/* update upper inode atime as needed */
-	if (err >= 0 || err == -EIOCBQUEUED)
+	if (err >= 0)
 		fsstack_copy_attr_atime(d_inode(file->f_path.dentry),
 					file_inode(lower_file));
 out:
-	return err;
+	return seccontiofs_stat(sb, slot, SECCONTIOFS_OP_READ, stat_start, err);
 }
 
 /*
  * seccontiofs write_iter, redirect modified iocb to lower write_iter
+ *
+ * Like the read side this serves write(2) as well, including O_DIRECT.
  */
 ssize_t
 seccontiofs_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 {
-	int		err;
 	struct file    *file = iocb->ki_filp, *lower_file;
+	/* once an async request is queued, @file may go before we return */
+	struct super_block *sb = file_inode(file)->i_sb;
+	int		slot = seccontiofs_F(file)->slot;
+	u64 stat_start = seccontiofs_stat_start(sb, slot, SECCONTIOFS_OP_WRITE);
+	ssize_t		err;
+	struct seccontiofs_aio_req *req;
+	s64		wait;
 
-	lower_file = seccontiofs_lower_file(file);
+	lower_file = seccontiofs_iocb_lower(iocb);
+	if (IS_ERR(lower_file)) {
+		err = PTR_ERR(lower_file);
+		goto out;
+	}
 	if (!lower_file->f_op->write_iter) {
 		err = -EINVAL;
 		goto out;
 	}
+	if ((iocb->ki_flags & IOCB_DIRECT) &&
+	    !seccontiofs_lower_direct_ok(lower_file)) {
+		err = -EINVAL;
+		goto out;
+	}
+	err = security_file_permission(lower_file, MAY_WRITE);
+	if (err)
+		goto out;
+	err = seccontiofs_quota_check(file);
+	if (err)
+		goto out;
+	wait = seccontiofs_iocb_throttle(iocb, iter);
+	if (wait < 0) {
+		err = wait;
+		goto out;
+	}
+
+	if (!is_sync_kiocb(iocb)) {
+		req = seccontiofs_aio_req_alloc(iocb, lower_file, true);
+		if (!req) {
+			err = -ENOMEM;
+			goto out;
+		}
+		if (wait) {
+			err = seccontiofs_aio_defer(file, req, iter, wait);
+			if (err != -EIOCBQUEUED)
+				seccontiofs_aio_cleanup(req, err);
+			goto out;
+		}
+		/* as aio itself does, freeze protection covers submission only */
+		file_start_write(lower_file);
+		err = lower_file->f_op->write_iter(&req->iocb, iter);
+		file_end_write(lower_file);
+		if (err != -EIOCBQUEUED)
+			seccontiofs_aio_cleanup(req, err);
+		goto out;
+	}
+
+	err = seccontiofs_throttle_wait(wait);
+	if (err)
+		goto out;
+
 	get_file(lower_file);	/* prevent lower_file from being released */
 	iocb->ki_filp = lower_file;
+	file_start_write(lower_file);
 	err = lower_file->f_op->write_iter(iocb, iter);
+	file_end_write(lower_file);
 	iocb->ki_filp = file;
 	fput(lower_file);
+	if (err > 0)
+		fsnotify_modify(lower_file);
 	/* update upper inode times/sizes as needed */
-	if (err >= 0 || err == -EIOCBQUEUED) {
+	if (err >= 0) {
 		fsstack_copy_inode_size(d_inode(file->f_path.dentry),
 					file_inode(lower_file));
 		fsstack_copy_attr_times(d_inode(file->f_path.dentry),
 					file_inode(lower_file));
 	}
+	seccontiofs_mark_dirty(file);
+	seccontiofs_quota_update(file);
 out:
-	return err;
+	return seccontiofs_stat(sb, slot, SECCONTIOFS_OP_WRITE, stat_start, err);
+}
+
+/*
+ * splice straight from the lower file, so page-cache pages of the base
+ * rootfs reach a pipe (or sendfile's socket) without a userspace bounce
+ */
+static ssize_t
+seccontiofs_splice_read(struct file *file, loff_t *ppos,
+			struct pipe_inode_info *pipe, size_t len,
+			unsigned int flags)
+{
+	u64 stat_start =
+		seccontiofs_stat_start_file(file, SECCONTIOFS_OP_SPLICE_READ);
+	ssize_t		err;
+	struct file    *lower_file;
+
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_SPLICE_READ,
+					     stat_start, PTR_ERR(lower_file));
+	/* no splice support below: go through our ->read_iter */
+	if (!lower_file->f_op->splice_read)
+		return generic_file_splice_read(file, ppos, pipe, len, flags);
+	err = seccontiofs_throttle_wait(seccontiofs_throttle(file, len));
+	if (err)
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_SPLICE_READ,
+					     stat_start, err);
+	seccontiofs_sync_ra(file, lower_file);
+
+	err = lower_file->f_op->splice_read(lower_file, ppos, pipe, len, flags);
+	/* update upper inode atime as needed */
+	if (err >= 0)
+		fsstack_copy_attr_atime(d_inode(file->f_path.dentry),
+					file_inode(lower_file));
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_SPLICE_READ,
+				     stat_start, err);
+}
+
+static ssize_t
+seccontiofs_splice_write(struct pipe_inode_info *pipe, struct file *file,
+			 loff_t *ppos, size_t len, unsigned int flags)
+{
+	u64 stat_start =
+		seccontiofs_stat_start_file(file, SECCONTIOFS_OP_SPLICE_WRITE);
+	ssize_t		err;
+	struct file    *lower_file;
+
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_SPLICE_WRITE,
+					     stat_start, PTR_ERR(lower_file));
+	/* no splice support below: go through our ->write_iter */
+	if (!lower_file->f_op->splice_write)
+		return iter_file_splice_write(pipe, file, ppos, len, flags);
+	err = seccontiofs_quota_check(file);
+	if (err)
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_SPLICE_WRITE,
+					     stat_start, err);
+	err = seccontiofs_throttle_wait(seccontiofs_throttle(file, len));
+	if (err)
+		return seccontiofs_stat_file(file, SECCONTIOFS_OP_SPLICE_WRITE,
+					     stat_start, err);
+	file_start_write(lower_file);
+	err = lower_file->f_op->splice_write(pipe, lower_file, ppos, len, flags);
+	file_end_write(lower_file);
+	seccontiofs_mark_dirty(file);
+	/* update upper inode times/sizes as needed */
+	if (err > 0) {
+		fsstack_copy_inode_size(d_inode(file->f_path.dentry),
+					file_inode(lower_file));
+		fsstack_copy_attr_times(d_inode(file->f_path.dentry),
+					file_inode(lower_file));
+		seccontiofs_quota_update(file);
+	}
+	return seccontiofs_stat_file(file, SECCONTIOFS_OP_SPLICE_WRITE,
+				     stat_start, err);
+}
+
+/*
+ * Lower files for a copy/clone between two seccontiofs files.  The VFS has
+ * already made sure both ends sit on this mount; sharing extents further
+ * requires both lower files to be on the same lower superblock.
+ */
+static int
+seccontiofs_lower_pair(struct file *file_in, struct file *file_out,
+		       struct file **lower_in, struct file **lower_out)
+{
+	*lower_in = seccontiofs_open_lower(file_in);
+	if (IS_ERR(*lower_in))
+		return PTR_ERR(*lower_in);
+	*lower_out = seccontiofs_open_lower(file_out);
+	if (IS_ERR(*lower_out))
+		return PTR_ERR(*lower_out);
+	if (file_inode(*lower_in)->i_sb != file_inode(*lower_out)->i_sb)
+		return -EXDEV;
+	return 0;
+}
+
+/* refresh upper attributes of both ends after the lower changed them */
+static void
+seccontiofs_copy_attr_pair(struct file *file_in, struct file *lower_in,
+			   struct file *file_out, struct file *lower_out)
+{
+	fsstack_copy_attr_atime(file_inode(file_in), file_inode(lower_in));
+	fsstack_copy_inode_size(file_inode(file_out), file_inode(lower_out));
+	fsstack_copy_attr_times(file_inode(file_out), file_inode(lower_out));
+	seccontiofs_quota_update(file_out);
+}
+
+static ssize_t
+seccontiofs_copy_file_range(struct file *file_in, loff_t pos_in,
+			    struct file *file_out, loff_t pos_out,
+			    size_t len, unsigned int flags)
+{
+	u64 stat_start = seccontiofs_stat_start_file(file_out,
+						     SECCONTIOFS_OP_COPY_RANGE);
+	ssize_t		err;
+	struct file    *lower_in, *lower_out;
+
+	err = seccontiofs_lower_pair(file_in, file_out, &lower_in, &lower_out);
+	if (err)
+		return seccontiofs_stat_file(file_out, SECCONTIOFS_OP_COPY_RANGE,
+					     stat_start, err);
+	err = seccontiofs_quota_check(file_out);
+	if (err)
+		return seccontiofs_stat_file(file_out, SECCONTIOFS_OP_COPY_RANGE,
+					     stat_start, err);
+	/* the lower picks clone, its own copy or an in-kernel splice */
+	err = vfs_copy_file_range(lower_in, pos_in, lower_out, pos_out,
+				  len, flags);
+	seccontiofs_mark_dirty(file_out);
+	if (err > 0)
+		seccontiofs_copy_attr_pair(file_in, lower_in,
+					   file_out, lower_out);
+	return seccontiofs_stat_file(file_out, SECCONTIOFS_OP_COPY_RANGE,
+				     stat_start, err);
+}
+
+static int
+seccontiofs_clone_file_range(struct file *file_in, loff_t pos_in,
+			     struct file *file_out, loff_t pos_out, u64 len)
+{
+	u64 stat_start = seccontiofs_stat_start_file(file_out,
+						     SECCONTIOFS_OP_CLONE);
+	int		err;
+	struct file    *lower_in, *lower_out;
+
+	err = seccontiofs_lower_pair(file_in, file_out, &lower_in, &lower_out);
+	if (err)
+		return seccontiofs_stat_file(file_out, SECCONTIOFS_OP_CLONE,
+					     stat_start, err);
+	err = seccontiofs_quota_check(file_out);
+	if (err)
+		return seccontiofs_stat_file(file_out, SECCONTIOFS_OP_CLONE,
+					     stat_start, err);
+	err = vfs_clone_file_range(lower_in, pos_in, lower_out, pos_out, len);
+	seccontiofs_mark_dirty(file_out);
+	if (!err)
+		seccontiofs_copy_attr_pair(file_in, lower_in,
+					   file_out, lower_out);
+	return seccontiofs_stat_file(file_out, SECCONTIOFS_OP_CLONE,
+				     stat_start, err);
+}
+
+static ssize_t
+seccontiofs_dedupe_file_range(struct file *src_file, u64 loff, u64 len,
+			      struct file *dst_file, u64 dst_loff)
+{
+	u64 stat_start = seccontiofs_stat_start_file(dst_file,
+						     SECCONTIOFS_OP_DEDUPE);
+	ssize_t		err;
+	struct file    *lower_src, *lower_dst;
+
+	err = seccontiofs_lower_pair(src_file, dst_file, &lower_src, &lower_dst);
+	if (err)
+		return seccontiofs_stat_file(dst_file, SECCONTIOFS_OP_DEDUPE,
+					     stat_start, err);
+	/* same answer vfs_dedupe_file_range gives for an unsupported fs */
+	if (!lower_src->f_op->dedupe_file_range)
+		return seccontiofs_stat_file(dst_file, SECCONTIOFS_OP_DEDUPE,
+					     stat_start, -EINVAL);
+	err = lower_src->f_op->dedupe_file_range(lower_src, loff, len,
+						 lower_dst, dst_loff);
+	if (err > 0)
+		seccontiofs_copy_attr_pair(src_file, lower_src,
+					   dst_file, lower_dst);
+	return seccontiofs_stat_file(dst_file, SECCONTIOFS_OP_DEDUPE,
+				     stat_start, err);
 }
 
 const struct file_operations seccontiofs_main_fops = {
-	.llseek = generic_file_llseek,
-	.read = seccontiofs_read,
-	.write = seccontiofs_write,
+	.llseek = seccontiofs_main_llseek,
 	.unlocked_ioctl = seccontiofs_unlocked_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl = seccontiofs_compat_ioctl,
 #endif
 	.mmap = seccontiofs_mmap,
+	.get_unmapped_area = seccontiofs_get_unmapped_area,
+#ifdef VM_SYNC
+	.mmap_supported_flags = MAP_SYNC,
+#endif
 	.open = seccontiofs_open,
 	.flush = seccontiofs_flush,
 	.release = seccontiofs_file_release,
 	.fsync = seccontiofs_fsync,
 	.fasync = seccontiofs_fasync,
+	.lock = seccontiofs_lock,
+	.flock = seccontiofs_flock,
+	.setlease = seccontiofs_setlease,
 	.read_iter = seccontiofs_read_iter,
 	.write_iter = seccontiofs_write_iter,
+	.fallocate = seccontiofs_fallocate,
+#ifdef SECCONTIOFS_HAVE_FADVISE
+	.fadvise = seccontiofs_fadvise,
+#endif
+	.splice_read = seccontiofs_splice_read,
+	.splice_write = seccontiofs_splice_write,
+	.copy_file_range = seccontiofs_copy_file_range,
+	.clone_file_range = seccontiofs_clone_file_range,
+	.dedupe_file_range = seccontiofs_dedupe_file_range,
 };
 
 /* trimmed directory options */
@@ -3,11 +3,18 @@
 static int seccontiofs_create(struct inode *dir, struct dentry *dentry,
 			 umode_t mode, bool want_excl)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(dir,
+						      SECCONTIOFS_OP_CREATE);
 	int err;
 	struct dentry *lower_dentry;
 	struct dentry *lower_parent_dentry = NULL;
 	struct path lower_path;
 
+	err = seccontiofs_quota_check_inodes(dir->i_sb);
+	if (err)
+		return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_CREATE,
+					      stat_start, err);
+
 	seccontiofs_get_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_parent_dentry = lock_parent(lower_dentry);
@@ -19,21 +26,25 @@ static int seccontiofs_create(struct inode *dir, struct dentry *dentry,
 	err = seccontiofs_interpose(dentry, dir->i_sb, &lower_path);
 	if (err)
 		goto out;
+	seccontiofs_quota_create(d_inode(dentry));
 	fsstack_copy_attr_times(dir, seccontiofs_lower_inode(dir));
 	fsstack_copy_inode_size(dir, d_inode(lower_parent_dentry));
 
 out:
 	unlock_dir(lower_parent_dentry);
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_CREATE,
+				      stat_start, err);
 }
 
 static int seccontiofs_link(struct dentry *old_dentry, struct inode *dir,
 		       struct dentry *new_dentry)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(dir, SECCONTIOFS_OP_LINK);
 	struct dentry *lower_old_dentry;
 	struct dentry *lower_new_dentry;
 	struct dentry *lower_dir_dentry;
+	struct inode *lower_inode;
 	u64 file_size_save;
 	int err;
 	struct path lower_old_path, lower_new_path;
@@ -45,6 +56,17 @@ static int seccontiofs_link(struct dentry *old_dentry, struct inode *dir,
 	lower_new_dentry = lower_new_path.dentry;
 	lower_dir_dentry = lock_parent(lower_new_dentry);
 
+	/*
+	 * An O_TMPFILE opened without O_EXCL, as vfs_link() just checked:
+	 * let the lower one be linked too.  The lower vfs_link() clears it.
+	 */
+	lower_inode = d_inode(lower_old_dentry);
+	if (d_inode(old_dentry)->i_state & I_LINKABLE) {
+		spin_lock(&lower_inode->i_lock);
+		lower_inode->i_state |= I_LINKABLE;
+		spin_unlock(&lower_inode->i_lock);
+	}
+
 	err = vfs_link(lower_old_dentry, d_inode(lower_dir_dentry),
 		       lower_new_dentry, NULL);
 	if (err || !d_inode(lower_new_dentry))
@@ -62,11 +84,85 @@ out:
 	unlock_dir(lower_dir_dentry);
 	seccontiofs_put_lower_path(old_dentry, &lower_old_path);
 	seccontiofs_put_lower_path(new_dentry, &lower_new_path);
-	return err;
+	return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_LINK,
+				      stat_start, err);
+}
+
+/*
+ * O_TMPFILE: make the unnamed inode in the lower directory and hang it
+ * off our (unhashed) dentry.  Whether it may be linked (no O_EXCL) is only
+ * known once we return, so the lower inode is made linkable by ->link.
+ */
+static int seccontiofs_tmpfile(struct inode *dir, struct dentry *dentry,
+			       umode_t mode)
+{
+	u64 stat_start = seccontiofs_stat_start_inode(dir,
+						      SECCONTIOFS_OP_TMPFILE);
+	static const struct qstr name = QSTR_INIT("/", 1);
+	int err;
+	struct inode *inode, *lower_dir;
+	struct dentry *lower_dentry;
+	struct path lower_parent_path, lower_path;
+
+	err = seccontiofs_quota_check_inodes(dir->i_sb);
+	if (err)
+		return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_TMPFILE,
+					      stat_start, err);
+
+	seccontiofs_get_lower_path(dentry->d_parent, &lower_parent_path);
+	lower_dir = d_inode(lower_parent_path.dentry);
+
+	err = -EOPNOTSUPP;
+	if (!lower_dir->i_op->tmpfile)
+		goto out;
+	err = inode_permission(lower_dir, MAY_WRITE | MAY_EXEC);
+	if (err)
+		goto out;
+
+	/* allocate dentry private data.  We free it in ->d_release */
+	err = new_dentry_private_data(dentry);
+	if (err)
+		goto out;
+
+	lower_dentry = d_alloc(lower_parent_path.dentry, &name);
+	if (!lower_dentry) {
+		err = -ENOMEM;
+		goto out;
+	}
+	/* the lower ->tmpfile is called directly, so is the LSM hook */
+	err = security_inode_create(lower_dir, lower_dentry, mode);
+	if (err)
+		goto out_dput;
+	err = lower_dir->i_op->tmpfile(lower_dir, lower_dentry, mode);
+	if (err)
+		goto out_dput;
+
+	inode = seccontiofs_iget(dir->i_sb, d_inode(lower_dentry));
+	if (IS_ERR(inode)) {
+		err = PTR_ERR(inode);
+		goto out_dput;
+	}
+	/* the lower dentry reference moves into our dentry */
+	lower_path.dentry = lower_dentry;
+	lower_path.mnt = mntget(lower_parent_path.mnt);
+	seccontiofs_set_lower_path(dentry, &lower_path);
+	d_instantiate(dentry, inode);
+	seccontiofs_quota_create(inode);
+	fsstack_copy_attr_times(dir, lower_dir);
+	goto out;
+
+out_dput:
+	dput(lower_dentry);
+out:
+	seccontiofs_put_lower_path(dentry->d_parent, &lower_parent_path);
+	return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_TMPFILE,
+				      stat_start, err);
 }
 
 static int seccontiofs_unlink(struct inode *dir, struct dentry *dentry)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(dir,
+						      SECCONTIOFS_OP_UNLINK);
 	int err;
 	struct dentry *lower_dentry;
 	struct inode *lower_dir_inode = seccontiofs_lower_inode(dir);
@@ -101,17 +197,25 @@ out:
 	unlock_dir(lower_dir_dentry);
 	dput(lower_dentry);
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_UNLINK,
+				      stat_start, err);
 }
 
 static int seccontiofs_symlink(struct inode *dir, struct dentry *dentry,
 			  const char *symname)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(dir,
+						      SECCONTIOFS_OP_SYMLINK);
 	int err;
 	struct dentry *lower_dentry;
 	struct dentry *lower_parent_dentry = NULL;
 	struct path lower_path;
 
+	err = seccontiofs_quota_check_inodes(dir->i_sb);
+	if (err)
+		return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_SYMLINK,
+					      stat_start, err);
+
 	seccontiofs_get_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_parent_dentry = lock_parent(lower_dentry);
@@ -122,22 +226,31 @@ static int seccontiofs_symlink(struct inode *dir, struct dentry *dentry,
 	err = seccontiofs_interpose(dentry, dir->i_sb, &lower_path);
 	if (err)
 		goto out;
+	seccontiofs_quota_create(d_inode(dentry));
 	fsstack_copy_attr_times(dir, seccontiofs_lower_inode(dir));
 	fsstack_copy_inode_size(dir, d_inode(lower_parent_dentry));
 
 out:
 	unlock_dir(lower_parent_dentry);
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_SYMLINK,
+				      stat_start, err);
 }
 
 static int seccontiofs_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(dir,
+						      SECCONTIOFS_OP_MKDIR);
 	int err;
 	struct dentry *lower_dentry;
 	struct dentry *lower_parent_dentry = NULL;
 	struct path lower_path;
 
+	err = seccontiofs_quota_check_inodes(dir->i_sb);
+	if (err)
+		return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_MKDIR,
+					      stat_start, err);
+
 	seccontiofs_get_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_parent_dentry = lock_parent(lower_dentry);
@@ -149,6 +262,7 @@ static int seccontiofs_mkdir(struct inode *dir, struct dentry *dentry, umode_t m
 	err = seccontiofs_interpose(dentry, dir->i_sb, &lower_path);
 	if (err)
 		goto out;
+	seccontiofs_quota_create(d_inode(dentry));
 
 	fsstack_copy_attr_times(dir, seccontiofs_lower_inode(dir));
 	fsstack_copy_inode_size(dir, d_inode(lower_parent_dentry));
@@ -158,11 +272,14 @@ static int seccontiofs_mkdir(struct inode *dir, struct dentry *dentry, umode_t m
 out:
 	unlock_dir(lower_parent_dentry);
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_MKDIR,
+				      stat_start, err);
 }
 
 static int seccontiofs_rmdir(struct inode *dir, struct dentry *dentry)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(dir,
+						      SECCONTIOFS_OP_RMDIR);
 	struct dentry *lower_dentry;
 	struct dentry *lower_dir_dentry;
 	int err;
@@ -186,17 +303,25 @@ static int seccontiofs_rmdir(struct inode *dir, struct dentry *dentry)
 out:
 	unlock_dir(lower_dir_dentry);
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_RMDIR,
+				      stat_start, err);
 }
 
 static int seccontiofs_mknod(struct inode *dir, struct dentry *dentry, umode_t mode,
 			dev_t dev)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(dir,
+						      SECCONTIOFS_OP_MKNOD);
 	int err;
 	struct dentry *lower_dentry;
 	struct dentry *lower_parent_dentry = NULL;
 	struct path lower_path;
 
+	err = seccontiofs_quota_check_inodes(dir->i_sb);
+	if (err)
+		return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_MKNOD,
+					      stat_start, err);
+
 	seccontiofs_get_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	lower_parent_dentry = lock_parent(lower_dentry);
@@ -208,13 +333,15 @@ static int seccontiofs_mknod(struct inode *dir, struct dentry *dentry, umode_t m
 	err = seccontiofs_interpose(dentry, dir->i_sb, &lower_path);
 	if (err)
 		goto out;
+	seccontiofs_quota_create(d_inode(dentry));
 	fsstack_copy_attr_times(dir, seccontiofs_lower_inode(dir));
 	fsstack_copy_inode_size(dir, d_inode(lower_parent_dentry));
 
 out:
 	unlock_dir(lower_parent_dentry);
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(dir, SECCONTIOFS_OP_MKNOD,
+				      stat_start, err);
 }
 
 /*
@@ -225,6 +352,8 @@ static int seccontiofs_rename(struct inode *old_dir, struct dentry *old_dentry,
 			 struct inode *new_dir, struct dentry *new_dentry,
 			 unsigned int flags)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(old_dir,
+						      SECCONTIOFS_OP_RENAME);
 	int err = 0;
 	struct dentry *lower_old_dentry = NULL;
 	struct dentry *lower_new_dentry = NULL;
@@ -233,9 +362,6 @@ static int seccontiofs_rename(struct inode *old_dir, struct dentry *old_dentry,
 	struct dentry *trap = NULL;
 	struct path lower_old_path, lower_new_path;
 
-	if (flags)
-		return -EINVAL;
-
 	seccontiofs_get_lower_path(old_dentry, &lower_old_path);
 	seccontiofs_get_lower_path(new_dentry, &lower_new_path);
 	lower_old_dentry = lower_old_path.dentry;
@@ -251,16 +377,28 @@ static int seccontiofs_rename(struct inode *old_dir, struct dentry *old_dentry,
 	}
 	/* target should not be ancestor of source */
 	if (trap == lower_new_dentry) {
-		err = -ENOTEMPTY;
+		err = (flags & RENAME_EXCHANGE) ? -EINVAL : -ENOTEMPTY;
 		goto out;
 	}
 
+	/*
+	 * RENAME_NOREPLACE/EXCHANGE/WHITEOUT are checked and carried out by
+	 * the lower fs; the VFS moves or exchanges our dentries afterwards,
+	 * and their lower paths travel with them.
+	 */
 	err = vfs_rename(d_inode(lower_old_dir_dentry), lower_old_dentry,
 			 d_inode(lower_new_dir_dentry), lower_new_dentry,
-			 NULL, 0);
+			 NULL, flags);
 	if (err)
 		goto out;
 
+	/* renamed inodes get a new ctime */
+	fsstack_copy_attr_times(d_inode(old_dentry),
+				d_inode(lower_old_dentry));
+	if ((flags & RENAME_EXCHANGE) && d_inode(new_dentry))
+		fsstack_copy_attr_times(d_inode(new_dentry),
+					d_inode(lower_new_dentry));
+
 	fsstack_copy_attr_all(new_dir, d_inode(lower_new_dir_dentry));
 	fsstack_copy_inode_size(new_dir, d_inode(lower_new_dir_dentry));
 	if (new_dir != old_dir) {
@@ -276,10 +414,13 @@ out:
 	dput(lower_new_dir_dentry);
 	seccontiofs_put_lower_path(old_dentry, &lower_old_path);
 	seccontiofs_put_lower_path(new_dentry, &lower_new_path);
-	return err;
+	return seccontiofs_stat_inode(old_dir, SECCONTIOFS_OP_RENAME,
+				      stat_start, err);
 }
 
-static int seccontiofs_readlink(struct dentry *dentry, char __user *buf, int bufsiz)
+/* also reads the target for seccontiofs_get_link, which counts itself */
+static int __seccontiofs_readlink(struct dentry *dentry, char __user *buf,
+				  int bufsiz)
 {
 	int err;
 	struct dentry *lower_dentry;
@@ -304,15 +445,32 @@ out:
 	return err;
 }
 
+static int seccontiofs_readlink(struct dentry *dentry, char __user *buf,
+				int bufsiz)
+{
+	u64 stat_start = seccontiofs_stat_start_inode(d_inode(dentry),
+						      SECCONTIOFS_OP_READLINK);
+
+	return seccontiofs_stat_inode(d_inode(dentry), SECCONTIOFS_OP_READLINK,
+				      stat_start,
+				      __seccontiofs_readlink(dentry, buf,
+							     bufsiz));
+}
+
 static const char *seccontiofs_get_link(struct dentry *dentry, struct inode *inode,
 				   struct delayed_call *done)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(inode,
+						      SECCONTIOFS_OP_GET_LINK);
 	char *buf;
 	int len = PAGE_SIZE, err;
 	mm_segment_t old_fs;
 
-	if (!dentry)
+	if (!dentry) {
+		seccontiofs_stat_inode(inode, SECCONTIOFS_OP_GET_LINK,
+				       stat_start, -ECHILD);
 		return ERR_PTR(-ECHILD);
+	}
 
 	/* This is freed by the put_link method assuming a successful call. */
 	buf = kmalloc(len, GFP_KERNEL);
@@ -324,7 +482,7 @@ static const char *seccontiofs_get_link(struct dentry *dentry, struct inode *ino
 	/* read the symlink, and then we will follow it */
 	old_fs = get_fs();
 	set_fs(KERNEL_DS);
-	err = seccontiofs_readlink(dentry, buf, len);
+	err = __seccontiofs_readlink(dentry, buf, len);
 	set_fs(old_fs);
 	if (err < 0) {
 		kfree(buf);
@@ -333,21 +491,28 @@ static const char *seccontiofs_get_link(struct dentry *dentry, struct inode *ino
 		buf[err] = '\0';
 	}
 	set_delayed_call(done, kfree_link, buf);
+	seccontiofs_stat_inode(inode, SECCONTIOFS_OP_GET_LINK, stat_start,
+			       PTR_ERR_OR_ZERO(buf));
 	return buf;
 }
 
 static int seccontiofs_permission(struct inode *inode, int mask)
 {
+	u64 stat_start =
+		seccontiofs_stat_start_inode(inode, SECCONTIOFS_OP_PERMISSION);
 	struct inode *lower_inode;
 	int err;
 
 	lower_inode = seccontiofs_lower_inode(inode);
 	err = inode_permission(lower_inode, mask);
-	return err;
+	return seccontiofs_stat_inode(inode, SECCONTIOFS_OP_PERMISSION,
+				      stat_start, err);
 }
 
 static int seccontiofs_setattr(struct dentry *dentry, struct iattr *ia)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(d_inode(dentry),
+						      SECCONTIOFS_OP_SETATTR);
 	int err;
 	struct dentry *lower_dentry;
 	struct inode *inode;
@@ -372,8 +537,12 @@ static int seccontiofs_setattr(struct dentry *dentry, struct iattr *ia)
 
 	/* prepare our own lower struct iattr (with the lower file) */
 	memcpy(&lower_ia, ia, sizeof(lower_ia));
-	if (ia->ia_valid & ATTR_FILE)
+	if (ia->ia_valid & ATTR_FILE) {
+		/* a lazily opened file has no lower file yet: go by path */
 		lower_ia.ia_file = seccontiofs_lower_file(ia->ia_file);
+		if (!lower_ia.ia_file)
+			lower_ia.ia_valid &= ~ATTR_FILE;
+	}
 
 	/*
 	 * If shrinking, first truncate upper level to cancel writing dirty
@@ -412,6 +581,12 @@ static int seccontiofs_setattr(struct dentry *dentry, struct iattr *ia)
 
 	/* get attributes from the lower inode */
 	fsstack_copy_attr_all(inode, lower_inode);
+	/* ftruncate is the file's label, truncate(2) the caller's */
+	if ((ia->ia_valid & (ATTR_SIZE | ATTR_FILE)) == (ATTR_SIZE | ATTR_FILE))
+		seccontiofs_quota_update(ia->ia_file);
+	else if (ia->ia_valid & ATTR_SIZE)
+		seccontiofs_quota_charge(inode,
+			seccontiofs_lbl_slot(seccontiofs_cur_lbl(inode->i_sb)));
 	/*
 	 * Not running fsstack_copy_inode_size(inode, lower_inode), because
 	 * VFS should update our inode size, and notify_change on
@@ -421,18 +596,19 @@ static int seccontiofs_setattr(struct dentry *dentry, struct iattr *ia)
 out:
 	seccontiofs_put_lower_path(dentry, &lower_path);
 out_err:
-	return err;
+	return seccontiofs_stat_inode(d_inode(dentry), SECCONTIOFS_OP_SETATTR,
+				      stat_start, err);
 }
 
 static int seccontiofs_getattr(struct vfsmount *mnt, struct dentry *dentry,
 			  struct kstat *stat)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(d_inode(dentry),
+						      SECCONTIOFS_OP_GETATTR);
 	int err;
 	struct kstat lower_stat;
 	struct path lower_path;
 
-	TRACE_DBG;
-
 	seccontiofs_get_lower_path(dentry, &lower_path);
 	err = vfs_getattr(&lower_path, &lower_stat);
 	if (err)
@@ -443,13 +619,16 @@ static int seccontiofs_getattr(struct vfsmount *mnt, struct dentry *dentry,
 	stat->blocks = lower_stat.blocks;
 out:
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(d_inode(dentry), SECCONTIOFS_OP_GETATTR,
+				      stat_start, err);
 }
 
 static int
 seccontiofs_setxattr(struct dentry *dentry, struct inode *inode, const char *name,
 		const void *value, size_t size, int flags)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(inode,
+						      SECCONTIOFS_OP_SETXATTR);
 	int err; struct dentry *lower_dentry;
 	struct path lower_path;
 
@@ -466,22 +645,23 @@ seccontiofs_setxattr(struct dentry *dentry, struct inode *inode, const char *nam
 			      d_inode(lower_path.dentry));
 out:
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(inode, SECCONTIOFS_OP_SETXATTR,
+				      stat_start, err);
 }
 
 static ssize_t
 seccontiofs_getxattr(struct dentry *dentry, struct inode *inode,
 		const char *name, void *buffer, size_t size)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(inode,
+						      SECCONTIOFS_OP_GETXATTR);
 
 	int err;
 	struct dentry *lower_dentry;
 	struct inode *lower_inode;
 	struct path lower_path;
 
-	TRACE_DBG;
-
-	seccontiofs_D(dentry)->lbl = cg_to_lable(current);
+	seccontiofs_D(dentry)->lbl = seccontiofs_task_lbl(inode->i_sb);
 
 	seccontiofs_get_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
@@ -493,12 +673,13 @@ seccontiofs_getxattr(struct dentry *dentry, struct inode *inode,
 	err = vfs_getxattr(lower_dentry, name, buffer, size);
 
 	if (err > 0 && seccontiofs_D(dentry)->lbl && buffer && memcmp(name,"security.SMACK64",16) == 0) { // i.e. SMACK64*
-		_pr_info_tr("name: %s ; err: %d ; buffer: %s\n", name, err, (char *) buffer);
+		trace_seccontiofs_xattr_rewrite(inode, name, buffer, err,
+						seccontiofs_D(dentry)->lbl);
+		seccontiofs_audit(SECCONTIOFS_AUDIT_XATTR, inode->i_sb, inode,
+				  seccontiofs_D(dentry)->lbl, 0, buffer, err);
 		memset(buffer,0x00,(err < SECCONTIOFS_LABEL_LEN + 1) ? size : SECCONTIOFS_LABEL_LEN + 1);
-		if (seccontiofs_D(dentry)->lbl && strlen(seccontiofs_D(dentry)->lbl))
+		if (strlen(seccontiofs_D(dentry)->lbl))
 			memcpy(buffer,seccontiofs_D(dentry)->lbl,(size < SECCONTIOFS_LABEL_LEN) ? size : SECCONTIOFS_LABEL_LEN);
-		else
-			_pr_err_tr("FS inner LBL is not defined. Yet?\n");
 	}
 
 	if (err)
@@ -508,18 +689,19 @@ seccontiofs_getxattr(struct dentry *dentry, struct inode *inode,
 				d_inode(lower_path.dentry));
 out:
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(inode, SECCONTIOFS_OP_GETXATTR,
+				      stat_start, err);
 }
 
 static ssize_t
 seccontiofs_listxattr(struct dentry *dentry, char *buffer, size_t buffer_size)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(d_inode(dentry),
+						      SECCONTIOFS_OP_LISTXATTR);
 	int err;
 	struct dentry *lower_dentry;
 	struct path lower_path;
 
-	TRACE_DBG;
-
 	seccontiofs_get_lower_path(dentry, &lower_path);
 	lower_dentry = lower_path.dentry;
 	if (!(d_inode(lower_dentry)->i_opflags & IOP_XATTR)) {
@@ -533,12 +715,15 @@ seccontiofs_listxattr(struct dentry *dentry, char *buffer, size_t buffer_size)
 				d_inode(lower_path.dentry));
 out:
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(d_inode(dentry), SECCONTIOFS_OP_LISTXATTR,
+				      stat_start, err);
 }
 
 static int
 seccontiofs_removexattr(struct dentry *dentry, struct inode *inode, const char *name)
 {
+	u64 stat_start =
+		seccontiofs_stat_start_inode(inode, SECCONTIOFS_OP_REMOVEXATTR);
 	int err;
 	struct dentry *lower_dentry;
 	struct inode *lower_inode;
@@ -557,7 +742,30 @@ seccontiofs_removexattr(struct dentry *dentry, struct inode *inode, const char *
 	fsstack_copy_attr_all(d_inode(dentry), lower_inode);
 out:
 	seccontiofs_put_lower_path(dentry, &lower_path);
-	return err;
+	return seccontiofs_stat_inode(inode, SECCONTIOFS_OP_REMOVEXATTR,
+				      stat_start, err);
+}
+
+static int seccontiofs_fiemap(struct inode *inode,
+			      struct fiemap_extent_info *fieinfo,
+			      u64 start, u64 len)
+{
+	u64 stat_start = seccontiofs_stat_start_inode(inode,
+						      SECCONTIOFS_OP_FIEMAP);
+	struct inode *lower_inode = seccontiofs_lower_inode(inode);
+	int err;
+
+	if (!lower_inode->i_op->fiemap)
+		return seccontiofs_stat_inode(inode, SECCONTIOFS_OP_FIEMAP,
+					      stat_start, -EOPNOTSUPP);
+
+	/* ioctl_fiemap() only synced our (empty) mapping */
+	if (fieinfo->fi_flags & FIEMAP_FLAG_SYNC)
+		filemap_write_and_wait(lower_inode->i_mapping);
+
+	err = lower_inode->i_op->fiemap(lower_inode, fieinfo, start, len);
+	return seccontiofs_stat_inode(inode, SECCONTIOFS_OP_FIEMAP,
+				      stat_start, err);
 }
 
 const struct inode_operations seccontiofs_symlink_iops = {
@@ -579,6 +787,7 @@ const struct inode_operations seccontiofs_dir_iops = {
 	.rmdir		= seccontiofs_rmdir,
 	.mknod		= seccontiofs_mknod,
 	.rename		= seccontiofs_rename,
+	.tmpfile	= seccontiofs_tmpfile,
 	.permission	= seccontiofs_permission,
 	.setattr	= seccontiofs_setattr,
 	.getattr	= seccontiofs_getattr,
@@ -590,6 +799,7 @@ const struct inode_operations seccontiofs_main_iops = {
 	.setattr	= seccontiofs_setattr,
 	.getattr	= seccontiofs_getattr,
 	.listxattr	= seccontiofs_listxattr,
+	.fiemap		= seccontiofs_fiemap,
 };
 
 static int seccontiofs_xattr_get(const struct xattr_handler *handler,
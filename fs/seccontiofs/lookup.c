@@ -8,7 +8,7 @@ int seccontiofs_init_dentry_cache(void)
 	seccontiofs_dentry_cachep =
 		kmem_cache_create("seccontiofs_dentry",
 				  sizeof(struct seccontiofs_dentry_info),
-				  0, SLAB_RECLAIM_ACCOUNT, NULL);
+				  0, SLAB_RECLAIM_ACCOUNT | SLAB_ACCOUNT, NULL);
 
 	return seccontiofs_dentry_cachep ? 0 : -ENOMEM;
 }
@@ -23,6 +23,8 @@ void free_dentry_private_data(struct dentry *dentry)
 {
 	if (!dentry || !dentry->d_fsdata)
 		return;
+	percpu_counter_dec(&seccontiofs_usage(dentry->d_sb,
+				seccontiofs_D(dentry)->slot)->dentries);
 	kmem_cache_free(seccontiofs_dentry_cachep, dentry->d_fsdata);
 	dentry->d_fsdata = NULL;
 }
@@ -32,12 +34,18 @@ int new_dentry_private_data(struct dentry *dentry)
 {
 	struct seccontiofs_dentry_info *info = seccontiofs_D(dentry);
 
-	/* use zalloc to init dentry_info.lower_path */
-	info = kmem_cache_zalloc(seccontiofs_dentry_cachep, GFP_ATOMIC);
+	/*
+	 * use zalloc to init dentry_info.lower_path; we are always called
+	 * from process context, so let the charge to the caller's memcg be
+	 * enforced rather than overcommitted as an atomic allocation.
+	 */
+	info = kmem_cache_zalloc(seccontiofs_dentry_cachep, GFP_KERNEL);
 	if (!info)
 		return -ENOMEM;
 
 	spin_lock_init(&info->lock);
+	info->slot = seccontiofs_lbl_slot(seccontiofs_cur_lbl(dentry->d_sb));
+	percpu_counter_inc(&seccontiofs_usage(dentry->d_sb, info->slot)->dentries);
 	dentry->d_fsdata = info;
 
 	return 0;
@@ -91,6 +99,12 @@ struct inode *seccontiofs_iget(struct super_block *sb, struct inode *lower_inode
 	inode->i_ino = lower_inode->i_ino;
 	seccontiofs_set_lower_inode(inode, lower_inode);
 
+	/* charge the new inode to whoever brought it in */
+	info->slot = seccontiofs_lbl_slot(seccontiofs_cur_lbl(sb));
+	percpu_counter_inc(&seccontiofs_usage(sb, info->slot)->inodes);
+	/* blocks it already had are nobody's quota */
+	atomic64_set(&info->qblocks, lower_inode->i_blocks);
+
 	inode->i_version++;
 
 	/* use different set of inode ops for symlinks & directories */
@@ -122,7 +136,11 @@ struct inode *seccontiofs_iget(struct super_block *sb, struct inode *lower_inode
 		init_special_inode(inode, lower_inode->i_mode,
 				   lower_inode->i_rdev);
 
-	/* all well, copy inode attributes */
+	/*
+	 * all well, copy inode attributes; this carries i_flags, so S_DAX
+	 * of a DAX lower shows on our inode and the VFS skips page-cache
+	 * work (fadvise, readahead) we would never use anyway
+	 */
 	fsstack_copy_attr_all(inode, lower_inode);
 	fsstack_copy_inode_size(inode, lower_inode);
 
@@ -187,6 +205,62 @@ int seccontiofs_interpose(struct dentry *dentry, struct super_block *sb,
 	return PTR_ERR(ret_dentry);
 }
 
+/*
+ * Wrap a lower dentry handed out by the lower export ops.  The alias may
+ * be a fresh disconnected one from d_obtain_alias(), still without private
+ * data, and two decodes of the same handle may race to set it up.
+ *
+ * Consumes the reference on lower_dentry.
+ */
+struct dentry *seccontiofs_obtain_alias(struct super_block *sb,
+					struct dentry *lower_dentry)
+{
+	struct seccontiofs_dentry_info *info;
+	struct inode *inode;
+	struct dentry *dentry;
+	struct path lower_root;
+	int slot;
+
+	inode = seccontiofs_iget(sb, d_inode(lower_dentry));
+	if (IS_ERR(inode)) {
+		dput(lower_dentry);
+		return ERR_CAST(inode);
+	}
+	dentry = d_obtain_alias(inode);
+	if (IS_ERR(dentry) || READ_ONCE(dentry->d_fsdata)) {
+		dput(lower_dentry);
+		return dentry;
+	}
+
+	info = kmem_cache_zalloc(seccontiofs_dentry_cachep, GFP_KERNEL);
+	if (!info) {
+		dput(lower_dentry);
+		dput(dentry);
+		return ERR_PTR(-ENOMEM);
+	}
+	spin_lock_init(&info->lock);
+	info->slot = slot = seccontiofs_lbl_slot(seccontiofs_cur_lbl(sb));
+	seccontiofs_get_lower_path(sb->s_root, &lower_root);
+	info->lower_path.mnt = mntget(lower_root.mnt);
+	info->lower_path.dentry = lower_dentry;
+	seccontiofs_put_lower_path(sb->s_root, &lower_root);
+
+	spin_lock(&dentry->d_lock);
+	if (!dentry->d_fsdata) {
+		dentry->d_fsdata = info;
+		info = NULL;
+	}
+	spin_unlock(&dentry->d_lock);
+
+	if (info) {
+		path_put(&info->lower_path);
+		kmem_cache_free(seccontiofs_dentry_cachep, info);
+	} else {
+		percpu_counter_inc(&seccontiofs_usage(sb, slot)->dentries);
+	}
+	return dentry;
+}
+
 /*
  * Main driver function for seccontiofs's lookup.
  *
@@ -206,9 +280,6 @@ static struct dentry *__seccontiofs_lookup(struct dentry *dentry,
 	struct qstr this;
 	struct dentry *ret_dentry = NULL;
 
-	/* must initialize dentry operations */
-	d_set_d_op(dentry, &seccontiofs_dops);
-
 	if (IS_ROOT(dentry))
 		goto out;
 
@@ -279,6 +350,8 @@ out:
 struct dentry *seccontiofs_lookup(struct inode *dir, struct dentry *dentry,
 			     unsigned int flags)
 {
+	u64 stat_start = seccontiofs_stat_start_inode(dir,
+						      SECCONTIOFS_OP_LOOKUP);
 	int err;
 	struct dentry *ret, *parent;
 	struct path lower_parent_path;
@@ -308,5 +381,7 @@ struct dentry *seccontiofs_lookup(struct inode *dir, struct dentry *dentry,
 out:
 	seccontiofs_put_lower_path(parent, &lower_parent_path);
 	dput(parent);
+	seccontiofs_stat_inode(dir, SECCONTIOFS_OP_LOOKUP, stat_start,
+			       PTR_ERR_OR_ZERO(ret));
 	return ret;
 }
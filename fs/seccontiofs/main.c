@@ -1,5 +1,36 @@
 #include "seccontiofs.h"
 #include <linux/module.h>
+#include <linux/backing-dev.h>
+
+#define CREATE_TRACE_POINTS
+#include "seccontiofs_trace.h"
+
+DEFINE_STATIC_KEY_FALSE(seccontiofs_stats_on);
+
+/* writes are serialized by the module's kernel_param_lock */
+static int seccontiofs_stats_set(const char *val, const struct kernel_param *kp)
+{
+	bool on;
+	int err;
+
+	err = strtobool(val, &on);
+	if (err)
+		return err;
+	return seccontiofs_set_stats(on);
+}
+
+static int seccontiofs_stats_get(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%c",
+		       static_key_enabled(&seccontiofs_stats_on) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops seccontiofs_stats_ops = {
+	.set = seccontiofs_stats_set,
+	.get = seccontiofs_stats_get,
+};
+module_param_cb(stats, &seccontiofs_stats_ops, NULL, 0644);
+MODULE_PARM_DESC(stats, "Count calls, errors and latency per op (default: off)");
 
 /*
  * There is no need to lock the seccontiofs_super_info's rwsem as there is no
@@ -36,6 +67,39 @@ static int seccontiofs_read_super(struct super_block *sb, void *raw_data, int si
 		err = -ENOMEM;
 		goto out_free;
 	}
+	seccontiofs_init_lbl_cache(seccontiofs_SB(sb));
+	INIT_LIST_HEAD(&seccontiofs_SB(sb)->dirty);
+	spin_lock_init(&seccontiofs_SB(sb)->dirty_lock);
+	err = seccontiofs_init_usage(seccontiofs_SB(sb));
+	if (err) {
+		kfree(seccontiofs_SB(sb));
+		sb->s_fs_info = NULL;
+		goto out_free;
+	}
+	err = seccontiofs_init_throttle(seccontiofs_SB(sb));
+	if (err) {
+		seccontiofs_destroy_usage(seccontiofs_SB(sb));
+		kfree(seccontiofs_SB(sb));
+		sb->s_fs_info = NULL;
+		goto out_free;
+	}
+	err = seccontiofs_init_quota(seccontiofs_SB(sb));
+	if (err) {
+		seccontiofs_destroy_throttle(seccontiofs_SB(sb));
+		seccontiofs_destroy_usage(seccontiofs_SB(sb));
+		kfree(seccontiofs_SB(sb));
+		sb->s_fs_info = NULL;
+		goto out_free;
+	}
+	err = seccontiofs_init_stats(sb);
+	if (err) {
+		seccontiofs_destroy_quota(seccontiofs_SB(sb));
+		seccontiofs_destroy_throttle(seccontiofs_SB(sb));
+		seccontiofs_destroy_usage(seccontiofs_SB(sb));
+		kfree(seccontiofs_SB(sb));
+		sb->s_fs_info = NULL;
+		goto out_free;
+	}
 
 	/* set the lower superblock field of upper superblock */
 	lower_sb = lower_path.dentry->d_sb;
@@ -45,6 +109,20 @@ static int seccontiofs_read_super(struct super_block *sb, void *raw_data, int si
 	/* inherit maxbytes from lower file system */
 	sb->s_maxbytes = lower_sb->s_maxbytes;
 
+#ifndef SECCONTIOFS_HAVE_FADVISE
+	/*
+	 * readahead defaults (file_ra_state_init, fadvise NORMAL/SEQUENTIAL)
+	 * come from our bdi; make them the lower device's
+	 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+	/* refcounted since 4.12: generic_shutdown_super() puts s_bdi */
+	sb->s_bdi = bdi_get(lower_sb->s_bdi);
+#else
+	/* pinned by the lower sb, which we keep active */
+	sb->s_bdi = lower_sb->s_bdi;
+#endif
+#endif
+
 	/*
 	 * Our c/m/atime granularity is 1 ns because we may stack on file
 	 * systems whose granularity is as good.
@@ -54,7 +132,12 @@ static int seccontiofs_read_super(struct super_block *sb, void *raw_data, int si
 	sb->s_op = &seccontiofs_sops;
 	sb->s_xattr = seccontiofs_xattr_handlers;
 
-	sb->s_export_op = &seccontiofs_export_ops; /* adding NFS support */
+	/* every dentry we allocate, including export ops' aliases, is ours */
+	sb->s_d_op = &seccontiofs_dops;
+
+	/* adding NFS support, by wrapping the lower fs's own handles */
+	if (lower_sb->s_export_op)
+		sb->s_export_op = &seccontiofs_export_ops;
 
 	/* get a new inode and allocate our root dentry */
 	inode = seccontiofs_iget(sb, d_inode(lower_path.dentry));
@@ -67,7 +150,6 @@ static int seccontiofs_read_super(struct super_block *sb, void *raw_data, int si
 		err = -ENOMEM;
 		goto out_iput;
 	}
-	d_set_d_op(sb->s_root, &seccontiofs_dops);
 
 	/* link the upper and lower dentries */
 	sb->s_root->d_fsdata = NULL;
@@ -91,6 +173,18 @@ static int seccontiofs_read_super(struct super_block *sb, void *raw_data, int si
 		       "seccontiofs: mounted on top of %s type %s\n",
 		       dev_name, lower_sb->s_type->name);
 
+	/*
+	 * Buffered writes reach the lower page cache from the writer's own
+	 * context, so dirty pages and the lower inode's wb follow its cgroup
+	 * as they would without us; that only matters if the lower fs does
+	 * cgroup writeback at all.
+	 */
+	if (IS_ENABLED(CONFIG_CGROUP_WRITEBACK) && !silent &&
+	    !(lower_sb->s_iflags & SB_I_CGROUPWB))
+		printk(KERN_INFO
+		       "seccontiofs: %s has no cgroup writeback, io limits "
+		       "won't cover buffered writes\n", lower_sb->s_type->name);
+
 	seccontiofs_SB(sb)->__mode = SECCONTIOFS_WRITABLE_MODE;
 	seccontiofs_SB(sb)->lbl = NULL; // FIXME: should be passed via cmdline
 	goto out; /* all is well */
@@ -103,6 +197,11 @@ out_iput:
 out_sput:
 	/* drop refs we took earlier */
 	atomic_dec(&lower_sb->s_active);
+	seccontiofs_destroy_lbl_cache(seccontiofs_SB(sb));
+	seccontiofs_destroy_stats(seccontiofs_SB(sb));
+	seccontiofs_destroy_quota(seccontiofs_SB(sb));
+	seccontiofs_destroy_throttle(seccontiofs_SB(sb));
+	seccontiofs_destroy_usage(seccontiofs_SB(sb));
 	kfree(seccontiofs_SB(sb));
 	sb->s_fs_info = NULL;
 out_free:
@@ -135,6 +234,7 @@ static int __init init_seccontiofs_fs(void)
 	int err;
 
 	pr_info("Registering seccontiofs " SECCONTIOFS_VERSION "\n");
+	seccontiofs_throttle_selftest();
 
 	err = seccontiofs_init_inode_cache();
 	if (err)
@@ -142,11 +242,22 @@ static int __init init_seccontiofs_fs(void)
 	err = seccontiofs_init_dentry_cache();
 	if (err)
 		goto out;
+	err = seccontiofs_init_file_cache();
+	if (err)
+		goto out;
+	err = seccontiofs_init_audit();
+	if (err)
+		goto out;
+	seccontiofs_init_debugfs();
 	err = register_filesystem(&seccontiofs_fs_type);
+	if (err)
+		seccontiofs_destroy_audit();
 out:
 	if (err) {
+		seccontiofs_destroy_debugfs();
 		seccontiofs_destroy_inode_cache();
 		seccontiofs_destroy_dentry_cache();
+		seccontiofs_destroy_file_cache();
 	}
 	return err;
 }
@@ -155,7 +266,10 @@ static void __exit exit_seccontiofs_fs(void)
 {
 	seccontiofs_destroy_inode_cache();
 	seccontiofs_destroy_dentry_cache();
+	seccontiofs_destroy_file_cache();
 	unregister_filesystem(&seccontiofs_fs_type);
+	seccontiofs_destroy_debugfs();
+	seccontiofs_destroy_audit();
 	pr_info("Completed seccontiofs module unload\n");
 }
 
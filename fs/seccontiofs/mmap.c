@@ -1,81 +1,52 @@
 #include "seccontiofs.h"
 
-static int seccontiofs_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
-{
-	int err;
-	struct file *file, *lower_file;
-	const struct vm_operations_struct *lower_vm_ops;
-	struct vm_area_struct lower_vma;
-
-	memcpy(&lower_vma, vma, sizeof(struct vm_area_struct));
-	file = lower_vma.vm_file;
-	lower_vm_ops = seccontiofs_F(file)->lower_vm_ops;
-	BUG_ON(!lower_vm_ops);
-
-	lower_file = seccontiofs_lower_file(file);
-	/*
-	 * XXX: vm_ops->fault may be called in parallel.  Because we have to
-	 * resort to temporarily changing the vma->vm_file to point to the
-	 * lower file, a concurrent invocation of seccontiofs_fault could see a
-	 * different value.  In this workaround, we keep a different copy of
-	 * the vma structure in our stack, so we never expose a different
-	 * value of the vma->vm_file called to us, even temporarily.  A
-	 * better fix would be to change the calling semantics of ->fault to
-	 * take an explicit file pointer.
-	 */
-	lower_vma.vm_file = lower_file;
-	err = lower_vm_ops->fault(&lower_vma, vmf);
-	return err;
-}
-
-static int seccontiofs_page_mkwrite(struct vm_area_struct *vma,
-			       struct vm_fault *vmf)
+static ssize_t seccontiofs_direct_IO(struct kiocb *iocb, struct iov_iter *iter)
 {
-	int err = 0;
-	struct file *file, *lower_file;
-	const struct vm_operations_struct *lower_vm_ops;
-	struct vm_area_struct lower_vma;
-
-	memcpy(&lower_vma, vma, sizeof(struct vm_area_struct));
-	file = lower_vma.vm_file;
-	lower_vm_ops = seccontiofs_F(file)->lower_vm_ops;
-	BUG_ON(!lower_vm_ops);
-	if (!lower_vm_ops->page_mkwrite)
-		goto out;
+	u64 stat_start = seccontiofs_stat_start_file(iocb->ki_filp,
+						     SECCONTIOFS_OP_DIRECT_IO);
 
-	lower_file = seccontiofs_lower_file(file);
 	/*
-	 * XXX: vm_ops->page_mkwrite may be called in parallel.
-	 * Because we have to resort to temporarily changing the
-	 * vma->vm_file to point to the lower file, a concurrent
-	 * invocation of seccontiofs_page_mkwrite could see a different
-	 * value.  In this workaround, we keep a different copy of the
-	 * vma structure in our stack, so we never expose a different
-	 * value of the vma->vm_file called to us, even temporarily.
-	 * A better fix would be to change the calling semantics of
-	 * ->page_mkwrite to take an explicit file pointer.
+	 * This function should never be called directly.  We need it
+	 * to exist, to get past a check in open_check_o_direct(),
+	 * which is called from do_last(), and in F_SETFL.  Direct I/O
+	 * itself never touches our mapping: ->read_iter/->write_iter
+	 * hand IOCB_DIRECT requests to the lower file.
 	 */
-	lower_vma.vm_file = lower_file;
-	err = lower_vm_ops->page_mkwrite(&lower_vma, vmf);
-out:
-	return err;
+	return seccontiofs_stat_file(iocb->ki_filp, SECCONTIOFS_OP_DIRECT_IO,
+				     stat_start, -EINVAL);
 }
 
-static ssize_t seccontiofs_direct_IO(struct kiocb *iocb, struct iov_iter *iter)
+#ifndef SECCONTIOFS_HAVE_FADVISE
+/*
+ * Without ->fadvise, POSIX_FADV_WILLNEED and readahead(2) read ahead on
+ * our own mapping, which never holds pages.  Start that readahead on the
+ * lower mapping instead; the pages allocated for us are left on the list
+ * for read_pages() to free.  DONTNEED only ever sees our empty mapping
+ * and cannot be forwarded this way.
+ */
+static int seccontiofs_readpages(struct file *file,
+				 struct address_space *mapping,
+				 struct list_head *pages, unsigned nr_pages)
 {
-	/*
-	 * This function should never be called directly.  We need it
-	 * to exist, to get past a check in open_check_o_direct(),
-	 * which is called from do_last().
-	 */
-	return -EINVAL;
+	struct file *lower_file;
+	pgoff_t index;
+
+	if (!file)
+		return 0;
+	lower_file = seccontiofs_open_lower(file);
+	if (IS_ERR(lower_file))
+		return PTR_ERR(lower_file);
+	/* the list is in descending index order */
+	index = list_entry(pages->prev, struct page, lru)->index;
+	page_cache_sync_readahead(lower_file->f_mapping, &lower_file->f_ra,
+				  lower_file, index, nr_pages);
+	return 0;
 }
+#endif
 
 const struct address_space_operations seccontiofs_aops = {
 	.direct_IO = seccontiofs_direct_IO,
-};
-
-const struct vm_operations_struct seccontiofs_vm_ops = {
-	.fault		= seccontiofs_fault,
-	.page_mkwrite	= seccontiofs_page_mkwrite,
+#ifndef SECCONTIOFS_HAVE_FADVISE
+	.readpages = seccontiofs_readpages,
+#endif
 };
@@ -0,0 +1,199 @@
+#include "seccontiofs.h"
+
+/*
+ * Per-label space and inode quotas.
+ *
+ * Usage is the net change a label made to the lower fs since mount: the
+ * blocks an inode gains or loses are charged to the label of the file
+ * they were written through, as the difference between the lower i_blocks
+ * and what we saw last time (seccontiofs_quota_update), and new inodes to
+ * the label creating them.  An unlinked inode gives back only what it was
+ * charged with, never the blocks it had before we first saw it.
+ * Limits are checked against per-CPU counters before a write, so a label
+ * can overshoot by at most one request per CPU.  Blocks allocated through
+ * a shared mapping are charged at the next write, fsync or truncate.
+ */
+
+static inline struct seccontiofs_quota *
+seccontiofs_quota(struct super_block *sb, int slot)
+{
+	return &seccontiofs_SB(sb)->quota[slot];
+}
+
+/* -EDQUOT once the label writing through @file used up its space */
+int seccontiofs_quota_check(struct file *file)
+{
+	struct seccontiofs_quota *q =
+		seccontiofs_quota(file_inode(file)->i_sb,
+				  seccontiofs_F(file)->slot);
+	u64 limit = READ_ONCE(q->blocks_limit);
+
+	if (limit && percpu_counter_compare(&q->blocks, limit) >= 0)
+		return -EDQUOT;
+	return 0;
+}
+
+/* -EDQUOT if the caller may not create one more inode on @sb */
+int seccontiofs_quota_check_inodes(struct super_block *sb)
+{
+	struct seccontiofs_quota *q;
+	u64 limit;
+
+	/* no need to resolve the label without limits */
+	if (!READ_ONCE(seccontiofs_SB(sb)->quota_on))
+		return 0;
+	q = seccontiofs_quota(sb, seccontiofs_lbl_slot(seccontiofs_cur_lbl(sb)));
+	limit = READ_ONCE(q->inodes_limit);
+	if (limit && percpu_counter_compare(&q->inodes, limit) >= 0)
+		return -EDQUOT;
+	return 0;
+}
+
+/*
+ * Charge the label in @slot with the blocks @inode gained or lost below
+ * since the last update.
+ */
+void seccontiofs_quota_charge(struct inode *inode, int slot)
+{
+	struct seccontiofs_inode_info *info = seccontiofs_I(inode);
+	s64 blocks = info->lower_inode->i_blocks;
+	s64 delta = blocks - atomic64_xchg(&info->qblocks, blocks);
+
+	if (!delta)
+		return;
+	atomic64_add(delta, &info->qcharged[slot]);
+	percpu_counter_add(&seccontiofs_quota(inode->i_sb, slot)->blocks, delta);
+}
+
+/* the label of @file wrote through it: charge it with what that took */
+void seccontiofs_quota_update(struct file *file)
+{
+	seccontiofs_quota_charge(file_inode(file), seccontiofs_F(file)->slot);
+}
+
+/* a new inode, charged to the label that just brought it in */
+void seccontiofs_quota_create(struct inode *inode)
+{
+	seccontiofs_I(inode)->qcreated = true;
+	percpu_counter_inc(&seccontiofs_quota(inode->i_sb,
+					      seccontiofs_I(inode)->slot)->inodes);
+}
+
+/*
+ * @inode, unlinked, is being evicted: give back the blocks each label was
+ * charged with, and the inode if it was counted as created.  A label that
+ * freed more than it added has been credited for that already.
+ */
+void seccontiofs_quota_release(struct inode *inode)
+{
+	struct seccontiofs_inode_info *info = seccontiofs_I(inode);
+	s64 charged;
+	int i;
+
+	for (i = 0; i < SECCONTIOFS_NR_SLOTS; i++) {
+		charged = atomic64_xchg(&info->qcharged[i], 0);
+		if (charged > 0)
+			percpu_counter_sub(&seccontiofs_quota(inode->i_sb,
+							      i)->blocks,
+					   charged);
+	}
+	if (info->qcreated)
+		percpu_counter_dec(&seccontiofs_quota(inode->i_sb,
+						      info->slot)->inodes);
+}
+
+void seccontiofs_set_quota(struct super_block *sb, int slot,
+			   u64 bytes, u64 inodes)
+{
+	struct seccontiofs_sb_info *sbi = seccontiofs_SB(sb);
+	struct seccontiofs_quota *q = &sbi->quota[slot];
+	bool on = false;
+	int i;
+
+	WRITE_ONCE(q->blocks_limit, DIV_ROUND_UP_ULL(bytes, 512));
+	WRITE_ONCE(q->inodes_limit, inodes);
+	for (i = 0; i < SECCONTIOFS_NR_SLOTS; i++)
+		if (READ_ONCE(sbi->quota[i].inodes_limit))
+			on = true;
+	WRITE_ONCE(sbi->quota_on, on);
+}
+
+/* clamp what statfs reports to the caller's quota, if it has one */
+void seccontiofs_quota_statfs(struct super_block *sb, struct kstatfs *buf)
+{
+	struct seccontiofs_quota *q;
+	u64 limit, used, bsize = buf->f_bsize ? buf->f_bsize : 512;
+
+	q = seccontiofs_quota(sb, seccontiofs_lbl_slot(seccontiofs_cur_lbl(sb)));
+
+	limit = READ_ONCE(q->blocks_limit);
+	if (limit) {
+		used = percpu_counter_sum_positive(&q->blocks);
+		limit = div64_u64(limit * 512, bsize);
+		used = min(div64_u64(used * 512 + bsize - 1, bsize), limit);
+		buf->f_blocks = min(buf->f_blocks, limit);
+		buf->f_bfree = min(buf->f_bfree, limit - used);
+		buf->f_bavail = min(buf->f_bavail, limit - used);
+	}
+
+	limit = READ_ONCE(q->inodes_limit);
+	if (limit) {
+		used = min_t(u64, percpu_counter_sum_positive(&q->inodes), limit);
+		buf->f_files = min(buf->f_files, limit);
+		buf->f_ffree = min(buf->f_ffree, limit - used);
+	}
+}
+
+/* appended to the label's line in /proc/<pid>/mountstats */
+void seccontiofs_show_quota(struct seq_file *m, struct super_block *sb,
+			    int slot)
+{
+	struct seccontiofs_quota *q = seccontiofs_quota(sb, slot);
+	u64 blocks = READ_ONCE(q->blocks_limit);
+	u64 inodes = READ_ONCE(q->inodes_limit);
+
+	if (!blocks && !inodes)
+		return;
+	seq_printf(m, " used_bytes %lld/%llu used_inodes %lld/%llu",
+		   percpu_counter_sum(&q->blocks) * 512, blocks * 512,
+		   percpu_counter_sum(&q->inodes), inodes);
+}
+
+int seccontiofs_init_quota(struct seccontiofs_sb_info *sbi)
+{
+	struct seccontiofs_quota *q;
+	int i, err = 0;
+
+	for (i = 0; i < SECCONTIOFS_NR_SLOTS; i++) {
+		q = &sbi->quota[i];
+		err = percpu_counter_init(&q->blocks, 0, GFP_KERNEL);
+		if (err)
+			goto out_err;
+		err = percpu_counter_init(&q->inodes, 0, GFP_KERNEL);
+		if (err)
+			goto out_blocks;
+	}
+	return 0;
+
+out_blocks:
+	percpu_counter_destroy(&q->blocks);
+out_err:
+	while (--i >= 0) {
+		q = &sbi->quota[i];
+		percpu_counter_destroy(&q->inodes);
+		percpu_counter_destroy(&q->blocks);
+	}
+	return err;
+}
+
+void seccontiofs_destroy_quota(struct seccontiofs_sb_info *sbi)
+{
+	struct seccontiofs_quota *q;
+	int i;
+
+	for (i = 0; i < SECCONTIOFS_NR_SLOTS; i++) {
+		q = &sbi->quota[i];
+		percpu_counter_destroy(&q->inodes);
+		percpu_counter_destroy(&q->blocks);
+	}
+}
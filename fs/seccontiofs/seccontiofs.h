@@ -5,6 +5,7 @@
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/pagemap.h>
 #include <linux/mount.h>
 #include <linux/namei.h>
 #include <linux/seq_file.h>
@@ -16,8 +17,18 @@
 #include <linux/sched.h>
 #include <linux/xattr.h>
 #include <linux/exportfs.h>
+#include <linux/fiemap.h>
+#include <linux/fsnotify.h>
+#include <linux/security.h>
+#include <linux/percpu_counter.h>
+#include <linux/workqueue.h>
+#include <linux/mmu_context.h>
+#include <linux/cred.h>
+#include <linux/jump_label.h>
+#include <linux/version.h>
 
 #include <linux/cgroup.h>
+#include <linux/memcontrol.h>
 
 #include "seccontiofs_common.h"
 
@@ -31,14 +42,21 @@ extern int vfs_path_lookup(struct dentry *, struct vfsmount *,
 /* the file system name */
 #define SECCONTIOFS_NAME "seccontiofs"
 
+/* nowait I/O (RWF_NOWAIT, io_uring inline issue) needs both from the VFS */
+#if defined(IOCB_NOWAIT) && defined(FMODE_NOWAIT)
+#define SECCONTIOFS_HAVE_NOWAIT
+#endif
+
+/* ->fadvise appeared in 4.19; before that hints land on our own file */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0)
+#define SECCONTIOFS_HAVE_FADVISE
+#endif
+
 /* seccontiofs root inode number */
 #define SECCONTIOFS_ROOT_INO     1
 
-/* useful for tracking code reachability */
-#define TRACE_DBG printk(KERN_DEFAULT "-> DBG:%s:%s:%d\n", __FILE__, __func__, __LINE__)
-
-#define _pr_info_tr(fmt, arg...) printk(KERN_INFO KBUILD_MODNAME "(%s): " fmt, __func__ ,##arg)
-#define _pr_err_tr(fmt, arg...) printk(KERN_ERR KBUILD_MODNAME "(%s): " fmt, __func__ ,##arg)
+/* keep per-op statistics, see stats.c (module parameter "stats") */
+DECLARE_STATIC_KEY_FALSE(seccontiofs_stats_on);
 
 /* operations vectors defined in specific files */
 extern const struct file_operations seccontiofs_main_fops;
@@ -49,14 +67,19 @@ extern const struct inode_operations seccontiofs_symlink_iops;
 extern const struct super_operations seccontiofs_sops;
 extern const struct dentry_operations seccontiofs_dops;
 extern const struct address_space_operations seccontiofs_aops, seccontiofs_dummy_aops;
-extern const struct vm_operations_struct seccontiofs_vm_ops;
 extern const struct export_operations seccontiofs_export_ops;
 extern const struct xattr_handler *seccontiofs_xattr_handlers[];
 
+struct seccontiofs_aio_req;
+
 extern int seccontiofs_init_inode_cache(void);
 extern void seccontiofs_destroy_inode_cache(void);
 extern int seccontiofs_init_dentry_cache(void);
 extern void seccontiofs_destroy_dentry_cache(void);
+extern int seccontiofs_init_file_cache(void);
+extern void seccontiofs_destroy_file_cache(void);
+extern void seccontiofs_aio_submit(struct seccontiofs_aio_req *req);
+extern struct file *seccontiofs_open_lower(struct file *file);
 extern int new_dentry_private_data(struct dentry *dentry);
 extern void free_dentry_private_data(struct dentry *dentry);
 extern struct dentry *seccontiofs_lookup(struct inode *dir, struct dentry *dentry,
@@ -65,18 +88,166 @@ extern struct inode *seccontiofs_iget(struct super_block *sb,
 				 struct inode *lower_inode);
 extern int seccontiofs_interpose(struct dentry *dentry, struct super_block *sb,
 			    struct path *lower_path);
+extern struct dentry *seccontiofs_obtain_alias(struct super_block *sb,
+					       struct dentry *lower_dentry);
+extern int seccontiofs_sync_lbl(struct super_block *sb, int slot);
+extern int seccontiofs_init_throttle(struct seccontiofs_sb_info *sbi);
+extern void seccontiofs_destroy_throttle(struct seccontiofs_sb_info *sbi);
+extern u64 seccontiofs_throttle(struct file *file, size_t bytes);
+extern bool seccontiofs_throttle_busy(struct file *file);
+extern int seccontiofs_throttle_wait(u64 wait);
+extern void seccontiofs_throttle_defer(struct file *file,
+				       struct seccontiofs_aio_req *req,
+				       u64 wait);
+extern void seccontiofs_set_throttle(struct super_block *sb, int slot,
+				     u64 bps, u64 iops);
+extern void seccontiofs_show_throttle(struct seq_file *m,
+				      struct super_block *sb, int slot);
+#ifdef CONFIG_SECCONTIO_FS_SELFTEST
+extern void seccontiofs_throttle_selftest(void);
+#else
+static inline void seccontiofs_throttle_selftest(void) {}
+#endif
+extern int seccontiofs_init_quota(struct seccontiofs_sb_info *sbi);
+extern void seccontiofs_destroy_quota(struct seccontiofs_sb_info *sbi);
+extern int seccontiofs_quota_check(struct file *file);
+extern int seccontiofs_quota_check_inodes(struct super_block *sb);
+extern void seccontiofs_quota_charge(struct inode *inode, int slot);
+extern void seccontiofs_quota_update(struct file *file);
+extern void seccontiofs_quota_create(struct inode *inode);
+extern void seccontiofs_quota_release(struct inode *inode);
+extern void seccontiofs_set_quota(struct super_block *sb, int slot,
+				  u64 bytes, u64 inodes);
+extern void seccontiofs_quota_statfs(struct super_block *sb,
+				     struct kstatfs *buf);
+extern void seccontiofs_show_quota(struct seq_file *m,
+				   struct super_block *sb, int slot);
+extern int seccontiofs_set_stats(bool on);
+extern int seccontiofs_init_stats(struct super_block *sb);
+extern void seccontiofs_destroy_stats(struct seccontiofs_sb_info *sbi);
+extern void seccontiofs_init_debugfs(void);
+extern void seccontiofs_destroy_debugfs(void);
+extern s64 seccontiofs_stat(struct super_block *sb, int slot, int op,
+			    u64 start, s64 ret);
+extern int seccontiofs_init_audit(void);
+extern void seccontiofs_destroy_audit(void);
+extern void __seccontiofs_audit(int type, struct super_block *sb,
+				struct inode *inode, const char *lbl, int arg,
+				const char *old, int oldlen);
+extern int seccontiofs_init_usage(struct seccontiofs_sb_info *sbi);
+extern void seccontiofs_destroy_usage(struct seccontiofs_sb_info *sbi);
+extern void seccontiofs_init_lbl_cache(struct seccontiofs_sb_info *sbi);
+extern void seccontiofs_destroy_lbl_cache(struct seccontiofs_sb_info *sbi);
+extern const char *seccontiofs_task_lbl_slow(struct super_block *sb);
+
+/* label slots used to break per-mount accounting down by container */
+enum {
+	SECCONTIOFS_SLOT_NONE = 0,	/* no label resolved */
+	SECCONTIOFS_SLOT_PRIV,
+	SECCONTIOFS_SLOT_UNPRIV,
+	SECCONTIOFS_NR_SLOTS,
+};
+
+extern const char *seccontiofs_slot_names[SECCONTIOFS_NR_SLOTS];
+
+/* operations counted by stats.c, those moving data first */
+enum {
+	SECCONTIOFS_OP_READ = 0,
+	SECCONTIOFS_OP_WRITE,
+	SECCONTIOFS_OP_SPLICE_READ,
+	SECCONTIOFS_OP_SPLICE_WRITE,
+	SECCONTIOFS_OP_COPY_RANGE,
+	SECCONTIOFS_NR_IO_OPS,
+	SECCONTIOFS_OP_OPEN = SECCONTIOFS_NR_IO_OPS,
+	SECCONTIOFS_OP_FLUSH,
+	SECCONTIOFS_OP_RELEASE,
+	SECCONTIOFS_OP_FSYNC,
+	SECCONTIOFS_OP_MMAP,
+	SECCONTIOFS_OP_IOCTL,
+	SECCONTIOFS_OP_LLSEEK,
+	SECCONTIOFS_OP_READDIR,
+	SECCONTIOFS_OP_FALLOCATE,
+	SECCONTIOFS_OP_CLONE,
+	SECCONTIOFS_OP_DEDUPE,
+	SECCONTIOFS_OP_LOCK,
+	SECCONTIOFS_OP_FASYNC,
+	SECCONTIOFS_OP_GET_UNMAPPED_AREA,
+	SECCONTIOFS_OP_FADVISE,
+	SECCONTIOFS_OP_LOOKUP,
+	SECCONTIOFS_OP_CREATE,
+	SECCONTIOFS_OP_LINK,
+	SECCONTIOFS_OP_UNLINK,
+	SECCONTIOFS_OP_SYMLINK,
+	SECCONTIOFS_OP_MKDIR,
+	SECCONTIOFS_OP_RMDIR,
+	SECCONTIOFS_OP_MKNOD,
+	SECCONTIOFS_OP_RENAME,
+	SECCONTIOFS_OP_TMPFILE,
+	SECCONTIOFS_OP_PERMISSION,
+	SECCONTIOFS_OP_SETATTR,
+	SECCONTIOFS_OP_GETATTR,
+	SECCONTIOFS_OP_GETXATTR,
+	SECCONTIOFS_OP_SETXATTR,
+	SECCONTIOFS_OP_LISTXATTR,
+	SECCONTIOFS_OP_REMOVEXATTR,
+	SECCONTIOFS_OP_GET_LINK,
+	SECCONTIOFS_OP_READLINK,
+	SECCONTIOFS_OP_FIEMAP,
+	SECCONTIOFS_OP_DIRECT_IO,
+	SECCONTIOFS_NR_OPS,
+};
+
+/* log2 latency buckets, from below 256ns to a second and above */
+#define SECCONTIOFS_LAT_BUCKETS	24
+
+/* one op of one label, per CPU */
+struct seccontiofs_op_stats {
+	u64 calls;
+	u64 errors;
+	u64 bytes;
+	u64 lat[SECCONTIOFS_LAT_BUCKETS];
+};
 
 /* file private data */
 struct seccontiofs_file_info {
-	struct file *lower_file;
-	const struct vm_operations_struct *lower_vm_ops;
+	struct file *lower_file;	/* readers: opened on first I/O, see seccontiofs_open_lower */
+	struct path lower_path;
 	// internals
     int __mode;
+	const char *lbl;	/* label of the opener */
+	int slot;	/* label slot the open is charged to */
+	/* lower read lease mirroring ours, see seccontiofs_setlease */
+	const struct cred *lease_cred;	/* its setter's, to drop it with */
+	struct inode *lease_inode;
+	struct work_struct lease_break;
+};
+
+/* lower kiocb cloned from an async upper one */
+struct seccontiofs_aio_req {
+	struct kiocb iocb;		/* submitted to the lower file */
+	struct kiocb *orig_iocb;	/* completed from our ->ki_complete */
+	bool write;
+	/* lower completion, finished from a worker */
+	struct work_struct work;
+	long res, res2;
+	/* submission held back by the label's I/O limit */
+	struct list_head list;
+	u64 due;	/* ktime_get_ns() it may be submitted at */
+	struct iov_iter iter;
+	const void *iov;
+	struct mm_struct *mm;
+	const struct cred *cred;
 };
 
 /* seccontiofs inode data in memory */
 struct seccontiofs_inode_info {
 	struct inode *lower_inode;
+	// internals
+	int slot;	/* label slot the inode is charged to */
+	unsigned long lbl_dirty;	/* slots that wrote since their last flush */
+	atomic64_t qblocks;	/* lower i_blocks last charged, see quota.c */
+	atomic64_t qcharged[SECCONTIOFS_NR_SLOTS];	/* of that, per label */
+	bool qcreated;	/* counted by seccontiofs_quota_create */
 	struct inode vfs_inode;
 };
 
@@ -86,14 +257,77 @@ struct seccontiofs_dentry_info {
 	struct path lower_path;
 	// internals
 	const char *lbl;
+	int slot;	/* label slot the dentry is charged to */
+};
+
+/* live objects pinned by one label on one mount */
+struct seccontiofs_usage {
+	struct percpu_counter inodes;
+	struct percpu_counter dentries;
+	struct percpu_counter files;
+};
+
+/* a token bucket, see throttle.c */
+struct seccontiofs_tb {
+	spinlock_t lock;
+	u64 rate;	/* tokens per second, 0: unlimited */
+	s64 pool;	/* below zero: in debt */
+	u64 stamp;	/* ns of the last refill */
+	s64 __percpu *cache;
+};
+
+/* per-label I/O limits and what they cost */
+struct seccontiofs_throttle {
+	struct seccontiofs_tb bytes;
+	struct seccontiofs_tb ios;
+	struct percpu_counter throttled;
+	struct percpu_counter wait_us;
+	/* async requests held back, submitted in order by dwork */
+	spinlock_t lock;
+	struct list_head deferred;
+	struct delayed_work dwork;
+};
+
+/* cgroups of tasks seen on a mount, see seccontiofs_task_lbl() */
+#define SECCONTIOFS_LBL_CACHE	8
+
+/* per-label quota, limits of 0 meaning none */
+struct seccontiofs_quota {
+	struct percpu_counter blocks;	/* 512-byte units */
+	struct percpu_counter inodes;
+	u64 blocks_limit;
+	u64 inodes_limit;
 };
 
 /* seccontiofs super-block data in memory */
 struct seccontiofs_sb_info {
 	struct super_block *lower_sb;
+	bool lower_frozen;	/* we froze lower_sb in ->freeze_fs */
 	// internals
     int __mode;
 	const char *lbl;
+	struct seccontiofs_usage usage[SECCONTIOFS_NR_SLOTS];
+	struct seccontiofs_throttle throttle[SECCONTIOFS_NR_SLOTS];
+	struct seccontiofs_quota quota[SECCONTIOFS_NR_SLOTS];
+	bool quota_on;	/* some label has an inode limit */
+	/* memcg css | 1 if its tasks are privileged, 0: free */
+	unsigned long lbl_cache[SECCONTIOFS_LBL_CACHE];
+	unsigned int lbl_next;	/* entry to replace next */
+	spinlock_t lbl_lock;	/* serializes replacing entries */
+	/* [slot][op], see stats.c; NULL until statistics are first on */
+	struct seccontiofs_op_stats __percpu *stats;
+	struct list_head stats_list;	/* on seccontiofs_stats_sbs */
+	struct dentry *debugfs;
+	/* seccontiofs_dirty entries of evicted inodes, see seccontiofs_sync_lbl */
+	struct list_head dirty;
+	spinlock_t dirty_lock;
+};
+
+/* a lower inode some label wrote to through an upper inode since evicted */
+struct seccontiofs_dirty {
+	struct list_head list;
+	struct dentry *lower_dentry;
+	unsigned long lbl_dirty;
 };
 
 /*
@@ -117,15 +351,16 @@ static inline struct seccontiofs_inode_info *seccontiofs_I(const struct inode *i
 /* file to private Data */
 #define seccontiofs_F(file) ((struct seccontiofs_file_info *)((file)->private_data))
 
-/* file to lower file */
+/* file to lower file, NULL while a regular file has not done any I/O yet */
 static inline struct file *seccontiofs_lower_file(const struct file *f)
 {
-	return seccontiofs_F(f)->lower_file;
+	return READ_ONCE(seccontiofs_F(f)->lower_file);
 }
 
+/* installed with cmpxchg() by seccontiofs_open_lower(), read locklessly */
 static inline void seccontiofs_set_lower_file(struct file *f, struct file *val)
 {
-	seccontiofs_F(f)->lower_file = val;
+	WRITE_ONCE(seccontiofs_F(f)->lower_file, val);
 }
 
 /* inode to lower inode. */
@@ -218,24 +453,158 @@ static inline void unlock_dir(struct dentry *dir)
 
 /* internal helpers */
 
+/* label of the cgroup at @path, only its prefix matters */
+static inline const char *seccontiofs_cg_path_lbl(const char *path)
+{
+	return (strncmp(path, SECCONTIOFS_PRIV_CG_NAME, SECCONTIOFS_PRIV_CG_NAME_LEN) == 0) ?
+		SECCONTIOFS_PRIV_LBL : SECCONTIOFS_UNPRIV_LBL;
+}
+
 inline static const char *
 cg_to_lable(struct task_struct *task)
 {
-	char *buf, *lbl;
+	/*
+	 * Only the prefix decides the label, and task_cgroup_path() fills
+	 * a short buffer with the truncated path, so keep it on the stack.
+	 */
+	char buf[SECCONTIOFS_PRIV_CG_NAME_LEN + 1];
 
-	buf = kmalloc(PATH_MAX, GFP_NOFS);
+	buf[0] = '\0';
+	task_cgroup_path(task, buf, sizeof(buf));
 
-	if (!buf)
-		return NULL;
+	return seccontiofs_cg_path_lbl(buf);
+}
 
-	task_cgroup_path(task, buf, PATH_MAX);
+/* map a label onto its accounting slot */
+static inline int seccontiofs_lbl_slot(const char *lbl)
+{
+	if (!lbl)
+		return SECCONTIOFS_SLOT_NONE;
+	if (memcmp(lbl, SECCONTIOFS_PRIV_LBL, SECCONTIOFS_LABEL_LEN) == 0)
+		return SECCONTIOFS_SLOT_PRIV;
+	if (memcmp(lbl, SECCONTIOFS_UNPRIV_LBL, SECCONTIOFS_LABEL_LEN) == 0)
+		return SECCONTIOFS_SLOT_UNPRIV;
+	return SECCONTIOFS_SLOT_NONE;
+}
 
-	lbl = (memcmp(buf, SECCONTIOFS_PRIV_CG_NAME, SECCONTIOFS_PRIV_CG_NAME_LEN) == 0) ?
-		  SECCONTIOFS_PRIV_LBL : SECCONTIOFS_UNPRIV_LBL;
+/*
+ * Label of the calling task's cgroup.  Lookups, opens and creates all need
+ * it, so a mount remembers the cgroups it has already resolved; only the
+ * first task of a new one reads its cgroup's path.  Containers are moved
+ * into all hierarchies at once, so the label is taken from the memory
+ * cgroup's path.  Neither takes cgroup_mutex.
+ */
+static inline const char *seccontiofs_task_lbl(struct super_block *sb)
+{
+#ifdef CONFIG_MEMCG
+	struct seccontiofs_sb_info *sbi = seccontiofs_SB(sb);
+	unsigned long css, ent;
+	int i;
+
+	if (mem_cgroup_disabled())
+		return cg_to_lable(current);
+
+	rcu_read_lock();
+	css = (unsigned long)task_css(current, memory_cgrp_id);
+	for (i = 0; i < SECCONTIOFS_LBL_CACHE; i++) {
+		ent = READ_ONCE(sbi->lbl_cache[i]);
+		if ((ent & ~1UL) == css) {
+			rcu_read_unlock();
+			return (ent & 1) ? SECCONTIOFS_PRIV_LBL :
+					   SECCONTIOFS_UNPRIV_LBL;
+		}
+	}
+	rcu_read_unlock();
+	return seccontiofs_task_lbl_slow(sb);
+#else
+	return cg_to_lable(current);
+#endif
+}
+
+/* label of the calling task as seen through this mount */
+static inline const char *seccontiofs_cur_lbl(struct super_block *sb)
+{
+	const char *lbl = seccontiofs_SB(sb)->lbl;
+
+	return lbl ? lbl : seccontiofs_task_lbl(sb);
+}
+
+static inline struct seccontiofs_usage *
+seccontiofs_usage(struct super_block *sb, int slot)
+{
+	return &seccontiofs_SB(sb)->usage[slot];
+}
 
-	kfree(buf);
+/*
+ * Note that the label of @file wrote to its inode, see seccontiofs_sync_lbl.
+ * Called once the write is done, so a sync clearing the mark first is
+ * sure to find the pages the write dirtied.
+ */
+static inline void seccontiofs_mark_dirty(struct file *file)
+{
+	struct seccontiofs_inode_info *info = seccontiofs_I(file_inode(file));
+	int slot = seccontiofs_F(file)->slot;
 
-	return lbl;
+	if (!test_bit(slot, &info->lbl_dirty))
+		set_bit(slot, &info->lbl_dirty);
+}
+
+#include "seccontiofs_trace.h"
+
+DECLARE_STATIC_KEY_FALSE(seccontiofs_audit_on);
+
+/* queue an audit record (SECCONTIOFS_AUDIT_*) if the reader is there */
+static inline void seccontiofs_audit(int type, struct super_block *sb,
+				     struct inode *inode, const char *lbl,
+				     int arg, const char *old, int oldlen)
+{
+	if (static_branch_unlikely(&seccontiofs_audit_on))
+		__seccontiofs_audit(type, sb, inode, lbl, arg, old, oldlen);
+}
+
+/*
+ * Entry of @op, paired with seccontiofs_stat() on its way out: returns
+ * the timestamp to pass there, 0 while neither statistics nor the exit
+ * tracepoint want one.
+ */
+static inline u64 seccontiofs_stat_start(struct super_block *sb, int slot,
+					 int op)
+{
+	trace_seccontiofs_op_enter(sb, slot, op);
+	if (static_branch_unlikely(&seccontiofs_stats_on) ||
+	    trace_seccontiofs_op_exit_enabled())
+		return ktime_get_ns();
+	return 0;
+}
+
+/* entry of @op on @file, see seccontiofs_stat_file() */
+static inline u64 seccontiofs_stat_start_file(struct file *file, int op)
+{
+	return seccontiofs_stat_start(file_inode(file)->i_sb,
+				      seccontiofs_F(file)->slot, op);
+}
+
+/* entry of @op on @inode, see seccontiofs_stat_inode() */
+static inline u64 seccontiofs_stat_start_inode(struct inode *inode, int op)
+{
+	return seccontiofs_stat_start(inode->i_sb, seccontiofs_I(inode)->slot,
+				      op);
+}
+
+/* count @op on @file for its opener's label, passing @ret through */
+static inline s64 seccontiofs_stat_file(struct file *file, int op, u64 start,
+					s64 ret)
+{
+	return seccontiofs_stat(file_inode(file)->i_sb,
+				seccontiofs_F(file)->slot, op, start, ret);
+}
+
+/* count @op on @inode for the label the inode is charged to */
+static inline s64 seccontiofs_stat_inode(struct inode *inode, int op,
+					 u64 start, s64 ret)
+{
+	return seccontiofs_stat(inode->i_sb, seccontiofs_I(inode)->slot, op,
+				start, ret);
 }
 
 #endif	/* not _SECCONTIOFS_H_ */
@@ -40,6 +40,71 @@ typedef struct {
 #define SECCONTIOFS_IOCTL_MAGIC   'x'
 
 #define SECCONTIOFS_IOCTL_IOMSG   _IOW(SECCONTIOFS_IOCTL_MAGIC, 0x8F, sciomsg*)
+/* flush files written by the label in payload (len 0: the caller's label) */
+#define SECCONTIOFS_IOCTL_SYNC    _IOW(SECCONTIOFS_IOCTL_MAGIC, 0x90, sciomsg*)
+
+/* I/O limits of one label, 0 meaning unlimited (needs CAP_SYS_ADMIN) */
+typedef struct {
+    unsigned char label[SECCONTIOFS_LABEL_LEN];
+    __u8 pad[6];
+    __u64 bps;
+    __u64 iops;
+} ATTR_PACKED sciothrottle;
+
+#define SECCONTIOFS_IOCTL_THROTTLE _IOW(SECCONTIOFS_IOCTL_MAGIC, 0x91, sciothrottle*)
+
+/* space and inode quota of one label, 0 meaning none (needs CAP_SYS_ADMIN) */
+typedef struct {
+    unsigned char label[SECCONTIOFS_LABEL_LEN];
+    __u8 pad[6];
+    __u64 bytes;
+    __u64 inodes;
+} ATTR_PACKED sciquota;
+
+#define SECCONTIOFS_IOCTL_QUOTA   _IOW(SECCONTIOFS_IOCTL_MAGIC, 0x92, sciquota*)
+
+/*
+ * Audit events, read from /dev/seccontiofs_audit (see audit.c).  The
+ * device maps one area of sciaudit_hdr.stride bytes per possible CPU:
+ * a page holding the header, then the records of that CPU's ring.
+ */
+#define SECCONTIOFS_AUDIT_DEV     "seccontiofs_audit"
+
+enum {
+    SECCONTIOFS_AUDIT_OPEN = 1,     /* label an open was charged to */
+    SECCONTIOFS_AUDIT_TOGGLE,       /* mode toggle, arg 1: blocked */
+    SECCONTIOFS_AUDIT_XATTR,        /* SMACK label rewritten, old: prefix */
+};
+
+typedef struct {
+    __u64 head;         /* records written, by the kernel */
+    __u64 tail;         /* records consumed, see SECCONTIOFS_AUDIT_ACK */
+    __u64 dropped;      /* records lost to a full ring */
+    __u32 nr_records;   /* ring size, a power of two */
+    __u32 stride;       /* bytes from one CPU's header to the next */
+    __u32 nr_cpus;
+    __u32 pad;
+} ATTR_PACKED sciaudit_hdr;
+
+typedef struct {
+    __u64 ts_ns;        /* CLOCK_MONOTONIC */
+    __u64 ino;
+    __u32 pid;
+    __u32 dev;          /* of the seccontiofs mount, new_encode_dev() */
+    __u8 type;
+    __u8 arg;
+    unsigned char label[SECCONTIOFS_LABEL_LEN];
+    unsigned char old[4];
+} ATTR_PACKED sciaudit_rec;
+
+/* hand records up to tail of one CPU's ring back to the kernel */
+typedef struct {
+    __u32 cpu;
+    __u32 pad;
+    __u64 tail;
+} ATTR_PACKED sciaudit_ack;
+
+#define SECCONTIOFS_AUDIT_ACK     _IOW(SECCONTIOFS_IOCTL_MAGIC, 0x93, sciaudit_ack*)
 
 
 #endif //_SECCONTIOFS_COMMON_H
@@ -0,0 +1,236 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM seccontiofs
+
+#if !defined(_SECCONTIOFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SECCONTIOFS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* op numbers resolved in the format file, for perf and bpftrace too */
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_READ);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_WRITE);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_SPLICE_READ);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_SPLICE_WRITE);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_COPY_RANGE);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_OPEN);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_FLUSH);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_RELEASE);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_FSYNC);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_MMAP);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_IOCTL);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_LLSEEK);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_READDIR);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_FALLOCATE);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_CLONE);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_DEDUPE);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_LOCK);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_FASYNC);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_GET_UNMAPPED_AREA);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_FADVISE);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_LOOKUP);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_CREATE);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_LINK);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_UNLINK);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_SYMLINK);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_MKDIR);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_RMDIR);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_MKNOD);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_RENAME);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_TMPFILE);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_PERMISSION);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_SETATTR);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_GETATTR);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_GETXATTR);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_SETXATTR);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_LISTXATTR);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_REMOVEXATTR);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_GET_LINK);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_READLINK);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_FIEMAP);
+TRACE_DEFINE_ENUM(SECCONTIOFS_OP_DIRECT_IO);
+
+#define show_seccontiofs_op(op)						\
+	__print_symbolic(op,						\
+		{ SECCONTIOFS_OP_READ,		"read_iter" },		\
+		{ SECCONTIOFS_OP_WRITE,		"write_iter" },		\
+		{ SECCONTIOFS_OP_SPLICE_READ,	"splice_read" },	\
+		{ SECCONTIOFS_OP_SPLICE_WRITE,	"splice_write" },	\
+		{ SECCONTIOFS_OP_COPY_RANGE,	"copy_file_range" },	\
+		{ SECCONTIOFS_OP_OPEN,		"open" },		\
+		{ SECCONTIOFS_OP_FLUSH,		"flush" },		\
+		{ SECCONTIOFS_OP_RELEASE,	"release" },		\
+		{ SECCONTIOFS_OP_FSYNC,		"fsync" },		\
+		{ SECCONTIOFS_OP_MMAP,		"mmap" },		\
+		{ SECCONTIOFS_OP_IOCTL,		"ioctl" },		\
+		{ SECCONTIOFS_OP_LLSEEK,	"llseek" },		\
+		{ SECCONTIOFS_OP_READDIR,	"readdir" },		\
+		{ SECCONTIOFS_OP_FALLOCATE,	"fallocate" },		\
+		{ SECCONTIOFS_OP_CLONE,		"clone_file_range" },	\
+		{ SECCONTIOFS_OP_DEDUPE,	"dedupe_file_range" },	\
+		{ SECCONTIOFS_OP_LOCK,		"lock" },		\
+		{ SECCONTIOFS_OP_FASYNC,	"fasync" },		\
+		{ SECCONTIOFS_OP_GET_UNMAPPED_AREA, "get_unmapped_area" }, \
+		{ SECCONTIOFS_OP_FADVISE,	"fadvise" },		\
+		{ SECCONTIOFS_OP_LOOKUP,	"lookup" },		\
+		{ SECCONTIOFS_OP_CREATE,	"create" },		\
+		{ SECCONTIOFS_OP_LINK,		"link" },		\
+		{ SECCONTIOFS_OP_UNLINK,	"unlink" },		\
+		{ SECCONTIOFS_OP_SYMLINK,	"symlink" },		\
+		{ SECCONTIOFS_OP_MKDIR,		"mkdir" },		\
+		{ SECCONTIOFS_OP_RMDIR,		"rmdir" },		\
+		{ SECCONTIOFS_OP_MKNOD,		"mknod" },		\
+		{ SECCONTIOFS_OP_RENAME,	"rename" },		\
+		{ SECCONTIOFS_OP_TMPFILE,	"tmpfile" },		\
+		{ SECCONTIOFS_OP_PERMISSION,	"permission" },		\
+		{ SECCONTIOFS_OP_SETATTR,	"setattr" },		\
+		{ SECCONTIOFS_OP_GETATTR,	"getattr" },		\
+		{ SECCONTIOFS_OP_GETXATTR,	"getxattr" },		\
+		{ SECCONTIOFS_OP_SETXATTR,	"setxattr" },		\
+		{ SECCONTIOFS_OP_LISTXATTR,	"listxattr" },		\
+		{ SECCONTIOFS_OP_REMOVEXATTR,	"removexattr" },	\
+		{ SECCONTIOFS_OP_GET_LINK,	"get_link" },		\
+		{ SECCONTIOFS_OP_READLINK,	"readlink" },		\
+		{ SECCONTIOFS_OP_FIEMAP,	"fiemap" },		\
+		{ SECCONTIOFS_OP_DIRECT_IO,	"direct_IO" })
+
+/* labels are two characters, not always NUL-terminated where they come from */
+#define SECCONTIOFS_TRACE_LBL(dst, lbl)					\
+	do {								\
+		memset(dst, 0, SECCONTIOFS_LABEL_LEN + 1);		\
+		if (lbl)						\
+			memcpy(dst, lbl, SECCONTIOFS_LABEL_LEN);	\
+	} while (0)
+
+TRACE_EVENT(seccontiofs_op_enter,
+	TP_PROTO(struct super_block *sb, int slot, int op),
+
+	TP_ARGS(sb, slot, op),
+
+	TP_STRUCT__entry(
+		__field(dev_t,	dev)
+		__field(int,	slot)
+		__field(int,	op)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		__entry->slot	= slot;
+		__entry->op	= op;
+	),
+
+	TP_printk("dev %d:%d slot %d op %s",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->slot,
+		  show_seccontiofs_op(__entry->op))
+);
+
+TRACE_EVENT(seccontiofs_op_exit,
+	TP_PROTO(struct super_block *sb, int slot, int op, s64 ret, u64 ns),
+
+	TP_ARGS(sb, slot, op, ret, ns),
+
+	TP_STRUCT__entry(
+		__field(dev_t,	dev)
+		__field(int,	slot)
+		__field(int,	op)
+		__field(s64,	ret)
+		__field(u64,	ns)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		__entry->slot	= slot;
+		__entry->op	= op;
+		__entry->ret	= ret;
+		__entry->ns	= ns;
+	),
+
+	TP_printk("dev %d:%d slot %d op %s ret %lld ns %llu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->slot,
+		  show_seccontiofs_op(__entry->op), __entry->ret, __entry->ns)
+);
+
+/* the label an open (or a SMACK xattr read) was resolved to */
+TRACE_EVENT(seccontiofs_label,
+	TP_PROTO(struct super_block *sb, struct inode *inode, const char *lbl),
+
+	TP_ARGS(sb, inode, lbl),
+
+	TP_STRUCT__entry(
+		__field(dev_t,	dev)
+		__field(unsigned long,	ino)
+		__array(char,	lbl, SECCONTIOFS_LABEL_LEN + 1)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		__entry->ino	= inode->i_ino;
+		SECCONTIOFS_TRACE_LBL(__entry->lbl, lbl);
+	),
+
+	TP_printk("dev %d:%d ino %lu label %s",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->lbl)
+);
+
+TRACE_EVENT(seccontiofs_mode_toggle,
+	TP_PROTO(struct super_block *sb, const char *lbl, int mode,
+		 bool blocked),
+
+	TP_ARGS(sb, lbl, mode, blocked),
+
+	TP_STRUCT__entry(
+		__field(dev_t,	dev)
+		__array(char,	lbl, SECCONTIOFS_LABEL_LEN + 1)
+		__field(int,	mode)
+		__field(bool,	blocked)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		SECCONTIOFS_TRACE_LBL(__entry->lbl, lbl);
+		__entry->mode	= mode;
+		__entry->blocked = blocked;
+	),
+
+	TP_printk("dev %d:%d label %s mode %d%s",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->lbl,
+		  __entry->mode, __entry->blocked ? " blocked" : "")
+);
+
+/* a SMACK label read from below, replaced by the caller's label */
+TRACE_EVENT(seccontiofs_xattr_rewrite,
+	TP_PROTO(struct inode *inode, const char *name, const char *old,
+		 int len, const char *lbl),
+
+	TP_ARGS(inode, name, old, len, lbl),
+
+	TP_STRUCT__entry(
+		__field(dev_t,	dev)
+		__field(unsigned long,	ino)
+		__string(name,	name)
+		__array(char,	old, 16)
+		__array(char,	lbl, SECCONTIOFS_LABEL_LEN + 1)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_sb->s_dev;
+		__entry->ino	= inode->i_ino;
+		__assign_str(name, name);
+		memset(__entry->old, 0, sizeof(__entry->old));
+		memcpy(__entry->old, old,
+		       min_t(int, len, sizeof(__entry->old) - 1));
+		SECCONTIOFS_TRACE_LBL(__entry->lbl, lbl);
+	),
+
+	TP_printk("dev %d:%d ino %lu %s %s -> %s",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __get_str(name), __entry->old, __entry->lbl)
+);
+
+#endif /* _SECCONTIOFS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE seccontiofs_trace
+#include <trace/define_trace.h>
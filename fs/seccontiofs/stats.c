@@ -0,0 +1,257 @@
+#include "seccontiofs.h"
+#include <linux/debugfs.h>
+#include <linux/module.h>
+
+/*
+ * Per-mount, per-label operation statistics.
+ *
+ * Every VFS entry point counts calls, errors, bytes moved (I/O ops only)
+ * and a log2 histogram of its latency into per-CPU counters of the label
+ * it is charged to: the opener's for file ops, the inode's for inode ops.
+ * They are summed on read from debugfs:
+ *
+ *   /sys/kernel/debug/seccontiofs/<major:minor>/ops	one line per label/op
+ *   /sys/kernel/debug/seccontiofs/<major:minor>/reset	write anything to zero
+ *
+ * Async I/O is timed up to its submission.  The counters take about 26KB
+ * per CPU and mount, so a mount only gets them once statistics are turned
+ * on, and keeps them until unmounted.
+ */
+
+static struct dentry *seccontiofs_debugfs_root;
+
+/* every mount, so turning statistics on can allocate their counters */
+static LIST_HEAD(seccontiofs_stats_sbs);
+static DEFINE_MUTEX(seccontiofs_stats_lock);
+
+static const char *seccontiofs_op_names[SECCONTIOFS_NR_OPS] = {
+	[SECCONTIOFS_OP_READ]		= "read_iter",
+	[SECCONTIOFS_OP_WRITE]		= "write_iter",
+	[SECCONTIOFS_OP_SPLICE_READ]	= "splice_read",
+	[SECCONTIOFS_OP_SPLICE_WRITE]	= "splice_write",
+	[SECCONTIOFS_OP_COPY_RANGE]	= "copy_file_range",
+	[SECCONTIOFS_OP_OPEN]		= "open",
+	[SECCONTIOFS_OP_FLUSH]		= "flush",
+	[SECCONTIOFS_OP_RELEASE]	= "release",
+	[SECCONTIOFS_OP_FSYNC]		= "fsync",
+	[SECCONTIOFS_OP_MMAP]		= "mmap",
+	[SECCONTIOFS_OP_IOCTL]		= "ioctl",
+	[SECCONTIOFS_OP_LLSEEK]		= "llseek",
+	[SECCONTIOFS_OP_READDIR]	= "readdir",
+	[SECCONTIOFS_OP_FALLOCATE]	= "fallocate",
+	[SECCONTIOFS_OP_CLONE]		= "clone_file_range",
+	[SECCONTIOFS_OP_DEDUPE]		= "dedupe_file_range",
+	[SECCONTIOFS_OP_LOCK]		= "lock",
+	[SECCONTIOFS_OP_FASYNC]		= "fasync",
+	[SECCONTIOFS_OP_GET_UNMAPPED_AREA] = "get_unmapped_area",
+	[SECCONTIOFS_OP_FADVISE]	= "fadvise",
+	[SECCONTIOFS_OP_LOOKUP]		= "lookup",
+	[SECCONTIOFS_OP_CREATE]		= "create",
+	[SECCONTIOFS_OP_LINK]		= "link",
+	[SECCONTIOFS_OP_UNLINK]		= "unlink",
+	[SECCONTIOFS_OP_SYMLINK]	= "symlink",
+	[SECCONTIOFS_OP_MKDIR]		= "mkdir",
+	[SECCONTIOFS_OP_RMDIR]		= "rmdir",
+	[SECCONTIOFS_OP_MKNOD]		= "mknod",
+	[SECCONTIOFS_OP_RENAME]		= "rename",
+	[SECCONTIOFS_OP_TMPFILE]	= "tmpfile",
+	[SECCONTIOFS_OP_PERMISSION]	= "permission",
+	[SECCONTIOFS_OP_SETATTR]	= "setattr",
+	[SECCONTIOFS_OP_GETATTR]	= "getattr",
+	[SECCONTIOFS_OP_GETXATTR]	= "getxattr",
+	[SECCONTIOFS_OP_SETXATTR]	= "setxattr",
+	[SECCONTIOFS_OP_LISTXATTR]	= "listxattr",
+	[SECCONTIOFS_OP_REMOVEXATTR]	= "removexattr",
+	[SECCONTIOFS_OP_GET_LINK]	= "get_link",
+	[SECCONTIOFS_OP_READLINK]	= "readlink",
+	[SECCONTIOFS_OP_FIEMAP]		= "fiemap",
+	[SECCONTIOFS_OP_DIRECT_IO]	= "direct_IO",
+};
+
+/* bucket 0: below 256ns, bucket i: [2^(i+7), 2^(i+8)) ns, the last open */
+static inline int seccontiofs_lat_bucket(u64 ns)
+{
+	if (ns < 256)
+		return 0;
+	return min_t(int, ilog2(ns) - 7, SECCONTIOFS_LAT_BUCKETS - 1);
+}
+
+/* exit of @op started at @start, see seccontiofs_stat_start() */
+s64 seccontiofs_stat(struct super_block *sb, int slot, int op, u64 start,
+		     s64 ret)
+{
+	struct seccontiofs_op_stats __percpu *s;
+	u64 ns;
+
+	if (!start)
+		return ret;
+	ns = ktime_get_ns() - start;
+	trace_seccontiofs_op_exit(sb, slot, op, ret, ns);
+	if (!static_branch_unlikely(&seccontiofs_stats_on))
+		return ret;
+	s = seccontiofs_SB(sb)->stats + slot * SECCONTIOFS_NR_OPS + op;
+	this_cpu_inc(s->calls);
+	if (ret < 0 && ret != -EIOCBQUEUED)
+		this_cpu_inc(s->errors);
+	else if (ret > 0 && op < SECCONTIOFS_NR_IO_OPS)
+		this_cpu_add(s->bytes, ret);
+	this_cpu_inc(s->lat[seccontiofs_lat_bucket(ns)]);
+	return ret;
+}
+
+static int seccontiofs_ops_show(struct seq_file *m, void *v)
+{
+	struct seccontiofs_sb_info *sbi = m->private;
+	struct seccontiofs_op_stats sum, *s;
+	int slot, op, cpu, i;
+
+	seq_puts(m, "# label op calls errors bytes lat_ns[<256 <512 .. >=1s]\n");
+	if (!sbi->stats)
+		return 0;
+	for (slot = 0; slot < SECCONTIOFS_NR_SLOTS; slot++) {
+		for (op = 0; op < SECCONTIOFS_NR_OPS; op++) {
+			memset(&sum, 0, sizeof(sum));
+			for_each_possible_cpu(cpu) {
+				s = per_cpu_ptr(sbi->stats, cpu) +
+					slot * SECCONTIOFS_NR_OPS + op;
+				sum.calls += s->calls;
+				sum.errors += s->errors;
+				sum.bytes += s->bytes;
+				for (i = 0; i < SECCONTIOFS_LAT_BUCKETS; i++)
+					sum.lat[i] += s->lat[i];
+			}
+			if (!sum.calls)
+				continue;
+			seq_printf(m, "%s %s %llu %llu %llu",
+				   seccontiofs_slot_names[slot],
+				   seccontiofs_op_names[op],
+				   sum.calls, sum.errors, sum.bytes);
+			for (i = 0; i < SECCONTIOFS_LAT_BUCKETS; i++)
+				seq_printf(m, " %llu", sum.lat[i]);
+			seq_putc(m, '\n');
+		}
+	}
+	return 0;
+}
+
+static int seccontiofs_ops_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, seccontiofs_ops_show, inode->i_private);
+}
+
+static const struct file_operations seccontiofs_ops_fops = {
+	.owner		= THIS_MODULE,
+	.open		= seccontiofs_ops_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* counts racing with the reset may survive it */
+static ssize_t seccontiofs_reset_write(struct file *file,
+				       const char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	struct seccontiofs_sb_info *sbi = file_inode(file)->i_private;
+	int cpu;
+
+	if (!sbi->stats)
+		return count;
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(sbi->stats, cpu), 0,
+		       sizeof(struct seccontiofs_op_stats) *
+		       SECCONTIOFS_NR_SLOTS * SECCONTIOFS_NR_OPS);
+	return count;
+}
+
+static const struct file_operations seccontiofs_reset_fops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.write		= seccontiofs_reset_write,
+	.llseek		= noop_llseek,
+};
+
+/* under seccontiofs_stats_lock */
+static int seccontiofs_alloc_stats(struct seccontiofs_sb_info *sbi)
+{
+	if (sbi->stats)
+		return 0;
+	sbi->stats = __alloc_percpu(sizeof(struct seccontiofs_op_stats) *
+				    SECCONTIOFS_NR_SLOTS * SECCONTIOFS_NR_OPS,
+				    __alignof__(struct seccontiofs_op_stats));
+	return sbi->stats ? 0 : -ENOMEM;
+}
+
+/*
+ * The "stats" module parameter.  Every mount has its counters before the
+ * static key lets seccontiofs_stat() use them, and a mount coming up
+ * meanwhile sees the key under the same lock.
+ */
+int seccontiofs_set_stats(bool on)
+{
+	struct seccontiofs_sb_info *sbi;
+	int err = 0;
+
+	mutex_lock(&seccontiofs_stats_lock);
+	if (on) {
+		list_for_each_entry(sbi, &seccontiofs_stats_sbs, stats_list) {
+			err = seccontiofs_alloc_stats(sbi);
+			if (err)
+				break;
+		}
+		if (!err)
+			static_branch_enable(&seccontiofs_stats_on);
+	} else {
+		static_branch_disable(&seccontiofs_stats_on);
+	}
+	mutex_unlock(&seccontiofs_stats_lock);
+	return err;
+}
+
+int seccontiofs_init_stats(struct super_block *sb)
+{
+	struct seccontiofs_sb_info *sbi = seccontiofs_SB(sb);
+	char name[32];
+	int err = 0;
+
+	mutex_lock(&seccontiofs_stats_lock);
+	if (static_key_enabled(&seccontiofs_stats_on))
+		err = seccontiofs_alloc_stats(sbi);
+	if (!err)
+		list_add(&sbi->stats_list, &seccontiofs_stats_sbs);
+	mutex_unlock(&seccontiofs_stats_lock);
+	if (err)
+		return err;
+
+	/* without debugfs the counters are kept but not shown */
+	if (IS_ERR_OR_NULL(seccontiofs_debugfs_root))
+		return 0;
+	snprintf(name, sizeof(name), "%u:%u", MAJOR(sb->s_dev), MINOR(sb->s_dev));
+	sbi->debugfs = debugfs_create_dir(name, seccontiofs_debugfs_root);
+	if (IS_ERR_OR_NULL(sbi->debugfs))
+		return 0;
+	debugfs_create_file("ops", 0400, sbi->debugfs, sbi,
+			    &seccontiofs_ops_fops);
+	debugfs_create_file("reset", 0200, sbi->debugfs, sbi,
+			    &seccontiofs_reset_fops);
+	return 0;
+}
+
+void seccontiofs_destroy_stats(struct seccontiofs_sb_info *sbi)
+{
+	debugfs_remove_recursive(sbi->debugfs);
+	mutex_lock(&seccontiofs_stats_lock);
+	list_del(&sbi->stats_list);
+	mutex_unlock(&seccontiofs_stats_lock);
+	free_percpu(sbi->stats);
+}
+
+void seccontiofs_init_debugfs(void)
+{
+	seccontiofs_debugfs_root = debugfs_create_dir(SECCONTIOFS_NAME, NULL);
+}
+
+void seccontiofs_destroy_debugfs(void)
+{
+	debugfs_remove_recursive(seccontiofs_debugfs_root);
+}
@@ -6,6 +6,93 @@
  */
 static struct kmem_cache *seccontiofs_inode_cachep;
 
+/* @lower_inode has data or metadata a sync would still have to write */
+static bool seccontiofs_lower_dirty(struct inode *lower_inode)
+{
+	struct address_space *mapping = lower_inode->i_mapping;
+
+	return (READ_ONCE(lower_inode->i_state) & I_DIRTY) ||
+	       mapping_tagged(mapping, PAGECACHE_TAG_DIRTY) ||
+	       mapping_tagged(mapping, PAGECACHE_TAG_WRITEBACK) ||
+	       mapping_writably_mapped(mapping);
+}
+
+/*
+ * fsync @lower_dentry through a lower file of its own: unlike
+ * write_inode_now() this commits the journal or log of ext4, XFS and
+ * btrfs, as an fsync(2) of the label's own descriptors would.
+ */
+static int seccontiofs_fsync_lower(struct super_block *sb,
+				   struct dentry *lower_dentry)
+{
+	struct path lower_root, lower_path;
+	struct file *lower_file;
+	int err;
+
+	seccontiofs_get_lower_path(sb->s_root, &lower_root);
+	lower_path.mnt = lower_root.mnt;
+	lower_path.dentry = lower_dentry;
+	lower_file = dentry_open(&lower_path, O_RDONLY | O_LARGEFILE,
+				 current_cred());
+	seccontiofs_put_lower_path(sb->s_root, &lower_root);
+	if (IS_ERR(lower_file))
+		return PTR_ERR(lower_file);
+	err = vfs_fsync(lower_file, 0);
+	fput(lower_file);
+	return err;
+}
+
+static void seccontiofs_free_dirty(struct list_head *head)
+{
+	struct seccontiofs_dirty *d, *tmp;
+
+	list_for_each_entry_safe(d, tmp, head, list) {
+		dput(d->lower_dentry);
+		kfree(d);
+	}
+}
+
+/*
+ * @inode is going away with marks of labels that have not synced yet:
+ * hand them to the lower dentry, so their next seccontiofs_sync_lbl still
+ * flushes it.  Entries whose lower inode got clean meanwhile are dropped
+ * from the head as new ones come in.
+ */
+static void seccontiofs_keep_dirty(struct inode *inode,
+				   struct inode *lower_inode)
+{
+	struct seccontiofs_sb_info *sbi = seccontiofs_SB(inode->i_sb);
+	struct seccontiofs_dirty *d, *old, *n;
+	LIST_HEAD(clean);
+	int i = 0;
+
+	if (!seccontiofs_I(inode)->lbl_dirty || !lower_inode->i_nlink ||
+	    !seccontiofs_lower_dirty(lower_inode))
+		return;
+	d = kmalloc(sizeof(*d), GFP_NOFS);
+	if (!d)
+		return;
+	d->lower_dentry = d_find_any_alias(lower_inode);
+	if (!d->lower_dentry) {
+		kfree(d);
+		return;
+	}
+	d->lbl_dirty = seccontiofs_I(inode)->lbl_dirty;
+
+	spin_lock(&sbi->dirty_lock);
+	list_for_each_entry_safe(old, n, &sbi->dirty, list) {
+		if (i++ == 2)
+			break;
+		if (!seccontiofs_lower_dirty(d_inode(old->lower_dentry)))
+			list_move(&old->list, &clean);
+		else
+			list_move_tail(&old->list, &sbi->dirty);
+	}
+	list_add_tail(&d->list, &sbi->dirty);
+	spin_unlock(&sbi->dirty_lock);
+	seccontiofs_free_dirty(&clean);
+}
+
 /* final actions when unmounting a file system */
 static void seccontiofs_put_super(struct super_block *sb)
 {
@@ -16,11 +103,22 @@ static void seccontiofs_put_super(struct super_block *sb)
 	if (!spd)
 		return;
 
+	/* the lower dentries must go while we still pin the lower sb */
+	seccontiofs_free_dirty(&spd->dirty);
+
 	/* decrement lower super references */
 	s = seccontiofs_lower_super(sb);
+	/* unmounted while frozen: don't leave the lower fs frozen for good */
+	if (spd->lower_frozen)
+		thaw_super(s);
 	seccontiofs_set_lower_super(sb, NULL);
 	atomic_dec(&s->s_active);
 
+	seccontiofs_destroy_lbl_cache(spd);
+	seccontiofs_destroy_stats(spd);
+	seccontiofs_destroy_quota(spd);
+	seccontiofs_destroy_throttle(spd);
+	seccontiofs_destroy_usage(spd);
 	kfree(spd);
 	sb->s_fs_info = NULL;
 }
@@ -36,10 +134,140 @@ static int seccontiofs_statfs(struct dentry *dentry, struct kstatfs *buf)
 
 	/* set return buf to our f/s to avoid confusing user-level utils */
 	buf->f_type = SECCONTIOFS_SUPER_MAGIC;
+	/* a container sees its quota, not the whole lower fs */
+	if (!err)
+		seccontiofs_quota_statfs(dentry->d_sb, buf);
 
 	return err;
 }
 
+/*
+ * syncfs() on the mount: our own inodes never hold dirty data, so the
+ * waiting pass is where the lower fs is synced.
+ */
+static int seccontiofs_sync_fs(struct super_block *sb, int wait)
+{
+	int err;
+	struct super_block *lower_sb = seccontiofs_lower_super(sb);
+
+	if (!wait)
+		return 0;
+
+	down_read(&lower_sb->s_umount);
+	err = sync_filesystem(lower_sb);
+	up_read(&lower_sb->s_umount);
+	return err;
+}
+
+/*
+ * freeze_super() has already blocked new writes through the mount and
+ * synced the lower fs through ->sync_fs; freezing the lower super block
+ * is all that is left.  A lower fs frozen by someone else is just as
+ * quiet, so we go along with it but leave its thaw to them.
+ */
+static int seccontiofs_freeze_fs(struct super_block *sb)
+{
+	int err;
+
+	err = freeze_super(seccontiofs_lower_super(sb));
+	if (!err)
+		seccontiofs_SB(sb)->lower_frozen = true;
+	else if (err == -EBUSY)
+		err = 0;
+	return err;
+}
+
+static int seccontiofs_unfreeze_fs(struct super_block *sb)
+{
+	int err = 0;
+
+	if (seccontiofs_SB(sb)->lower_frozen) {
+		err = thaw_super(seccontiofs_lower_super(sb));
+		/* -EINVAL: thawed behind our back, nothing left to undo */
+		if (err == -EINVAL)
+			err = 0;
+		if (!err)
+			seccontiofs_SB(sb)->lower_frozen = false;
+	}
+	return err;
+}
+
+/*
+ * fsync every lower inode the label in @slot wrote to since its last
+ * flush, rather than the whole lower fs.  Walks s_inodes the way
+ * drop_pagecache_sb() does, then the inodes evicted with the mark still
+ * set.  Writers mark after writing, so clearing first cannot lose a write
+ * racing with us; shared writable mappings dirty pages behind our back and
+ * keep their mark for as long as they or their dirty pages are around.
+ */
+int seccontiofs_sync_lbl(struct super_block *sb, int slot)
+{
+	struct seccontiofs_sb_info *sbi = seccontiofs_SB(sb);
+	struct seccontiofs_dirty *d, *n;
+	struct inode *inode, *lower_inode, *toput_inode = NULL;
+	struct dentry *lower_dentry;
+	LIST_HEAD(evicted);
+	int err = 0, ret;
+
+	spin_lock(&sb->s_inode_list_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		spin_lock(&inode->i_lock);
+		if ((inode->i_state & (I_FREEING | I_WILL_FREE | I_NEW)) ||
+		    !test_bit(slot, &seccontiofs_I(inode)->lbl_dirty)) {
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		__iget(inode);
+		spin_unlock(&inode->i_lock);
+		spin_unlock(&sb->s_inode_list_lock);
+
+		lower_inode = seccontiofs_lower_inode(inode);
+		clear_bit(slot, &seccontiofs_I(inode)->lbl_dirty);
+		lower_dentry = d_find_any_alias(lower_inode);
+		if (lower_dentry) {
+			ret = seccontiofs_fsync_lower(sb, lower_dentry);
+			dput(lower_dentry);
+		} else {
+			ret = write_inode_now(lower_inode, 1);
+		}
+		if (ret && !err)
+			err = ret;
+		if (ret || seccontiofs_lower_dirty(lower_inode))
+			set_bit(slot, &seccontiofs_I(inode)->lbl_dirty);
+		iput(toput_inode);
+		toput_inode = inode;
+
+		cond_resched();
+		spin_lock(&sb->s_inode_list_lock);
+	}
+	spin_unlock(&sb->s_inode_list_lock);
+	iput(toput_inode);
+
+	/*
+	 * Nobody writes through an evicted inode: once fsync'ed it is
+	 * durable for every label, so the entry goes as a whole.
+	 */
+	spin_lock(&sbi->dirty_lock);
+	list_for_each_entry_safe(d, n, &sbi->dirty, list)
+		if (test_bit(slot, &d->lbl_dirty))
+			list_move_tail(&d->list, &evicted);
+	spin_unlock(&sbi->dirty_lock);
+	list_for_each_entry_safe(d, n, &evicted, list) {
+		cond_resched();
+		ret = seccontiofs_fsync_lower(sb, d->lower_dentry);
+		if (!ret)
+			continue;
+		if (!err)
+			err = ret;
+		/* failed: keep it for the next try */
+		spin_lock(&sbi->dirty_lock);
+		list_move_tail(&d->list, &sbi->dirty);
+		spin_unlock(&sbi->dirty_lock);
+	}
+	seccontiofs_free_dirty(&evicted);
+	return err;
+}
+
 /*
  * @flags: numeric mount options
  * @options: mount options string
@@ -74,13 +302,24 @@ static void seccontiofs_evict_inode(struct inode *inode)
 
 	truncate_inode_pages(&inode->i_data, 0);
 	clear_inode(inode);
+	lower_inode = seccontiofs_lower_inode(inode);
+	/*
+	 * The last link may go long before the last user (unlinked while
+	 * open, an O_TMPFILE never linked, a rename target): give the quota
+	 * back once nobody can use the inode through us any more.
+	 */
+	if (!lower_inode->i_nlink)
+		seccontiofs_quota_release(inode);
+	seccontiofs_keep_dirty(inode, lower_inode);
 	/*
 	 * Decrement a reference to a lower_inode, which was incremented
 	 * by our read_inode when it was created initially.
 	 */
-	lower_inode = seccontiofs_lower_inode(inode);
 	seccontiofs_set_lower_inode(inode, NULL);
 	iput(lower_inode);
+
+	percpu_counter_dec(&seccontiofs_usage(inode->i_sb,
+				seccontiofs_I(inode)->slot)->inodes);
 }
 
 static struct inode *seccontiofs_alloc_inode(struct super_block *sb)
@@ -118,7 +357,7 @@ int seccontiofs_init_inode_cache(void)
 	seccontiofs_inode_cachep =
 		kmem_cache_create("seccontiofs_inode_cache",
 				  sizeof(struct seccontiofs_inode_info), 0,
-				  SLAB_RECLAIM_ACCOUNT, init_once);
+				  SLAB_RECLAIM_ACCOUNT | SLAB_ACCOUNT, init_once);
 	if (!seccontiofs_inode_cachep)
 		err = -ENOMEM;
 	return err;
@@ -144,54 +383,294 @@ static void seccontiofs_umount_begin(struct super_block *sb)
 		lower_sb->s_op->umount_begin(lower_sb);
 }
 
+const char *seccontiofs_slot_names[SECCONTIOFS_NR_SLOTS] = {
+	[SECCONTIOFS_SLOT_NONE]		= "-",
+	[SECCONTIOFS_SLOT_PRIV]		= SECCONTIOFS_PRIV_LBL,
+	[SECCONTIOFS_SLOT_UNPRIV]	= SECCONTIOFS_UNPRIV_LBL,
+};
+
+int seccontiofs_init_usage(struct seccontiofs_sb_info *sbi)
+{
+	struct seccontiofs_usage *u;
+	int i, err = 0;
+
+	for (i = 0; i < SECCONTIOFS_NR_SLOTS; i++) {
+		u = &sbi->usage[i];
+		err = percpu_counter_init(&u->inodes, 0, GFP_KERNEL);
+		if (err)
+			goto out_err;
+		err = percpu_counter_init(&u->dentries, 0, GFP_KERNEL);
+		if (err)
+			goto out_inodes;
+		err = percpu_counter_init(&u->files, 0, GFP_KERNEL);
+		if (err)
+			goto out_dentries;
+	}
+	return 0;
+
+out_dentries:
+	percpu_counter_destroy(&u->dentries);
+out_inodes:
+	percpu_counter_destroy(&u->inodes);
+out_err:
+	while (--i >= 0) {
+		u = &sbi->usage[i];
+		percpu_counter_destroy(&u->files);
+		percpu_counter_destroy(&u->dentries);
+		percpu_counter_destroy(&u->inodes);
+	}
+	return err;
+}
+
+void seccontiofs_destroy_usage(struct seccontiofs_sb_info *sbi)
+{
+	struct seccontiofs_usage *u;
+	int i;
+
+	for (i = 0; i < SECCONTIOFS_NR_SLOTS; i++) {
+		u = &sbi->usage[i];
+		percpu_counter_destroy(&u->files);
+		percpu_counter_destroy(&u->dentries);
+		percpu_counter_destroy(&u->inodes);
+	}
+}
+
+void seccontiofs_init_lbl_cache(struct seccontiofs_sb_info *sbi)
+{
+	spin_lock_init(&sbi->lbl_lock);
+}
+
+/*
+ * A miss of seccontiofs_task_lbl(): resolve the label from the path of
+ * the caller's memcg and remember it.  cgroup_path() only takes kernfs'
+ * rename lock.  Cached entries pin their css, so its address can't come
+ * back as another cgroup's while it is cached; a removed container's
+ * memcg lives on until its entry is replaced.
+ */
+const char *seccontiofs_task_lbl_slow(struct super_block *sb)
+{
+#ifdef CONFIG_MEMCG
+	struct seccontiofs_sb_info *sbi = seccontiofs_SB(sb);
+	struct cgroup_subsys_state *css;
+	char buf[SECCONTIOFS_PRIV_CG_NAME_LEN + 1];
+	unsigned long ent, old = 0;
+	const char *lbl;
+	int i;
+
+	rcu_read_lock();
+	css = task_css(current, memory_cgrp_id);
+	if (!css_tryget(css))
+		css = NULL;
+	rcu_read_unlock();
+	/* a dying memcg: we are being moved, ask the slow way */
+	if (!css)
+		return cg_to_lable(current);
+
+	buf[0] = '\0';
+	cgroup_path(css->cgroup, buf, sizeof(buf));
+	lbl = seccontiofs_cg_path_lbl(buf);
+	ent = (unsigned long)css |
+	      (seccontiofs_lbl_slot(lbl) == SECCONTIOFS_SLOT_PRIV);
+
+	spin_lock(&sbi->lbl_lock);
+	for (i = 0; i < SECCONTIOFS_LBL_CACHE; i++)
+		if ((sbi->lbl_cache[i] & ~1UL) == (unsigned long)css)
+			break;
+	if (i == SECCONTIOFS_LBL_CACHE) {
+		i = sbi->lbl_next++ % SECCONTIOFS_LBL_CACHE;
+		old = sbi->lbl_cache[i];
+		WRITE_ONCE(sbi->lbl_cache[i], ent);
+		css = NULL;	/* our reference now belongs to the cache */
+	}
+	spin_unlock(&sbi->lbl_lock);
+
+	if (old)
+		css_put((struct cgroup_subsys_state *)(old & ~1UL));
+	if (css)
+		css_put(css);
+	return lbl;
+#else
+	return cg_to_lable(current);
+#endif
+}
+
+void seccontiofs_destroy_lbl_cache(struct seccontiofs_sb_info *sbi)
+{
+	int i;
+
+	for (i = 0; i < SECCONTIOFS_LBL_CACHE; i++)
+		if (sbi->lbl_cache[i])
+			css_put((struct cgroup_subsys_state *)
+				(sbi->lbl_cache[i] & ~1UL));
+}
+
+/*
+ * Per-label footprint of this mount, shown in /proc/<pid>/mountstats:
+ * live upper inodes, dentries and open files charged to each label.
+ */
+static int seccontiofs_show_stats(struct seq_file *m, struct dentry *root)
+{
+	struct super_block *sb = root->d_sb;
+	struct seccontiofs_usage *u;
+	int i;
+
+	for (i = 0; i < SECCONTIOFS_NR_SLOTS; i++) {
+		u = seccontiofs_usage(sb, i);
+		seq_printf(m, "\n\tlabel %s: inodes %lld dentries %lld files %lld",
+			   seccontiofs_slot_names[i],
+			   percpu_counter_sum_positive(&u->inodes),
+			   percpu_counter_sum_positive(&u->dentries),
+			   percpu_counter_sum_positive(&u->files));
+		seccontiofs_show_throttle(m, sb, i);
+		seccontiofs_show_quota(m, sb, i);
+	}
+	seq_putc(m, '\n');
+	return 0;
+}
+
 const struct super_operations seccontiofs_sops = {
 	.put_super	= seccontiofs_put_super,
 	.statfs		= seccontiofs_statfs,
+	.sync_fs	= seccontiofs_sync_fs,
+	.freeze_fs	= seccontiofs_freeze_fs,
+	.unfreeze_fs	= seccontiofs_unfreeze_fs,
 	.remount_fs	= seccontiofs_remount_fs,
 	.evict_inode	= seccontiofs_evict_inode,
 	.umount_begin	= seccontiofs_umount_begin,
 	.show_options	= generic_show_options,
+	.show_stats	= seccontiofs_show_stats,
 	.alloc_inode	= seccontiofs_alloc_inode,
 	.destroy_inode	= seccontiofs_destroy_inode,
 	.drop_inode	= generic_delete_inode,
 };
 
-/* NFS support */
+/*
+ * NFS support: our handles are the lower fs's handles, encoded and decoded
+ * by its own export ops, so they survive cache eviction and reboots just
+ * like handles of the lower fs itself.
+ */
 
-static struct inode *seccontiofs_nfs_get_inode(struct super_block *sb, u64 ino,
-					  u32 generation)
+static int seccontiofs_encode_fh(struct inode *inode, __u32 *fh, int *max_len,
+				 struct inode *parent)
 {
-	struct super_block *lower_sb;
-	struct inode *inode;
-	struct inode *lower_inode;
+	return exportfs_encode_inode_fh(seccontiofs_lower_inode(inode),
+					(struct fid *)fh, max_len,
+					parent ? seccontiofs_lower_inode(parent)
+					       : NULL);
+}
 
-	lower_sb = seccontiofs_lower_super(sb);
-	lower_inode = ilookup(lower_sb, ino);
-	inode = seccontiofs_iget(sb, lower_inode);
-	return inode;
+/*
+ * When we are stacked on a subtree of the lower fs, a lower dentry outside
+ * of it can't be handed out.  Directories found disconnected are checked
+ * as they are reconnected through seccontiofs_get_parent.
+ */
+static struct dentry *seccontiofs_decoded(struct super_block *sb,
+					  struct dentry *lower_dentry)
+{
+	struct path lower_root;
+	bool outside;
+
+	if (IS_ERR_OR_NULL(lower_dentry))
+		return lower_dentry ? lower_dentry : ERR_PTR(-ESTALE);
+
+	seccontiofs_get_lower_path(sb->s_root, &lower_root);
+	outside = !(lower_dentry->d_flags & DCACHE_DISCONNECTED) &&
+		  !is_subdir(lower_dentry, lower_root.dentry);
+	seccontiofs_put_lower_path(sb->s_root, &lower_root);
+	if (outside) {
+		dput(lower_dentry);
+		return ERR_PTR(-ESTALE);
+	}
+	return seccontiofs_obtain_alias(sb, lower_dentry);
 }
 
+/* exportfs_decode_fh() callback: connected and under our lower root */
+static int seccontiofs_acceptable(void *context, struct dentry *dentry)
+{
+	return is_subdir(dentry, context);
+}
+
+/*
+ * The lower exportfs_decode_fh() reconnects what it decodes and, stacked
+ * on a subtree, only takes it once it is connected below our root: a
+ * file known only by a handle without its parent can't be placed, so
+ * such handles are stale there, as with a subtree_check export.
+ */
 static struct dentry *seccontiofs_fh_to_dentry(struct super_block *sb,
 					  struct fid *fid, int fh_len,
 					  int fh_type)
 {
-	return generic_fh_to_dentry(sb, fid, fh_len, fh_type,
-				    seccontiofs_nfs_get_inode);
+	struct super_block *lower_sb = seccontiofs_lower_super(sb);
+	struct dentry *lower_dentry;
+	struct path lower_root;
+	bool whole;
+
+	if (!lower_sb->s_export_op->fh_to_dentry)
+		return ERR_PTR(-ESTALE);
+
+	seccontiofs_get_lower_path(sb->s_root, &lower_root);
+	whole = lower_root.dentry == lower_sb->s_root;
+	lower_dentry = exportfs_decode_fh(lower_root.mnt, fid, fh_len, fh_type,
+					  whole ? NULL : seccontiofs_acceptable,
+					  lower_root.dentry);
+	seccontiofs_put_lower_path(sb->s_root, &lower_root);
+	if (!lower_dentry)
+		return ERR_PTR(-ESTALE);
+	/* not acceptable comes back as -EACCES */
+	if (IS_ERR(lower_dentry) && PTR_ERR(lower_dentry) != -ENOMEM)
+		return ERR_PTR(-ESTALE);
+	if (IS_ERR(lower_dentry))
+		return lower_dentry;
+	return seccontiofs_obtain_alias(sb, lower_dentry);
 }
 
 static struct dentry *seccontiofs_fh_to_parent(struct super_block *sb,
 					  struct fid *fid, int fh_len,
 					  int fh_type)
 {
-	return generic_fh_to_parent(sb, fid, fh_len, fh_type,
-				    seccontiofs_nfs_get_inode);
+	struct super_block *lower_sb = seccontiofs_lower_super(sb);
+
+	if (!lower_sb->s_export_op->fh_to_parent)
+		return ERR_PTR(-ESTALE);
+	return seccontiofs_decoded(sb, lower_sb->s_export_op->fh_to_parent(
+					lower_sb, fid, fh_len, fh_type));
 }
 
-/*
- * all other funcs are default as defined in exportfs/expfs.c
- */
+static struct dentry *seccontiofs_get_parent(struct dentry *child)
+{
+	struct super_block *sb = child->d_sb;
+	struct super_block *lower_sb = seccontiofs_lower_super(sb);
+	struct dentry *lower_parent;
+	struct path lower_path, lower_root;
+	bool escaped;
+
+	seccontiofs_get_lower_path(child, &lower_path);
+	if (!(lower_path.dentry->d_flags & DCACHE_DISCONNECTED))
+		lower_parent = dget_parent(lower_path.dentry);
+	else if (lower_sb->s_export_op->get_parent)
+		lower_parent = lower_sb->s_export_op->get_parent(lower_path.dentry);
+	else
+		lower_parent = ERR_PTR(-EACCES);
+	seccontiofs_put_lower_path(child, &lower_path);
+	if (IS_ERR(lower_parent))
+		return lower_parent;
+
+	/* walking up past the lower fs root without meeting ours */
+	seccontiofs_get_lower_path(sb->s_root, &lower_root);
+	escaped = lower_parent == lower_sb->s_root &&
+		  lower_parent != lower_root.dentry;
+	seccontiofs_put_lower_path(sb->s_root, &lower_root);
+	if (escaped) {
+		dput(lower_parent);
+		return ERR_PTR(-ESTALE);
+	}
+	/* the alias of the lower root is our s_root */
+	return seccontiofs_obtain_alias(sb, lower_parent);
+}
 
 const struct export_operations seccontiofs_export_ops = {
+	.encode_fh	   = seccontiofs_encode_fh,
 	.fh_to_dentry	   = seccontiofs_fh_to_dentry,
-	.fh_to_parent	   = seccontiofs_fh_to_parent
+	.fh_to_parent	   = seccontiofs_fh_to_parent,
+	.get_parent	   = seccontiofs_get_parent,
 };
@@ -0,0 +1,328 @@
+#include "seccontiofs.h"
+
+/*
+ * Per-label I/O limits.
+ *
+ * Every label has a bytes/s and an IOs/s token bucket.  Tokens accrue in
+ * a shared pool from the time elapsed and are handed to CPUs in batches
+ * of 10ms worth, so the common case only touches a per-CPU counter.  A
+ * request that finds the pool empty is still admitted, but leaves the
+ * pool in debt and is told how long paying it back takes: sync callers
+ * sleep that long, async ones are queued on the label and submitted to
+ * the lower fs that much later from a worker (seccontiofs_throttle_defer).
+ */
+
+#define SECCONTIOFS_TB_BATCH_DIV	100	/* CPU batch: 10ms of tokens */
+#define SECCONTIOFS_TB_BURST_DIV	10	/* pool: at most 100ms of them */
+
+static int seccontiofs_tb_init(struct seccontiofs_tb *tb)
+{
+	spin_lock_init(&tb->lock);
+	tb->rate = 0;
+	tb->pool = 0;
+	tb->stamp = ktime_get_ns();
+	tb->cache = alloc_percpu(s64);
+	return tb->cache ? 0 : -ENOMEM;
+}
+
+static void seccontiofs_tb_set(struct seccontiofs_tb *tb, u64 rate)
+{
+	int cpu;
+
+	spin_lock(&tb->lock);
+	/* tokens cached by other CPUs may survive this; they are few */
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(tb->cache, cpu) = 0;
+	tb->pool = 0;
+	tb->stamp = ktime_get_ns();
+	WRITE_ONCE(tb->rate, rate);
+	spin_unlock(&tb->lock);
+}
+
+/* ns @tokens take to accrue at @rate, without overflowing the product */
+static u64 seccontiofs_tb_ns(u64 tokens, u64 rate)
+{
+	u64 secs, rem;
+
+	secs = div64_u64_rem(tokens, rate, &rem);
+	if (secs >= U64_MAX / NSEC_PER_SEC)
+		return U64_MAX;
+	/* rem < rate, so both may lose low bits alike */
+	while (rate > U32_MAX) {
+		rate >>= 1;
+		rem >>= 1;
+	}
+	return secs * NSEC_PER_SEC + mul_u64_u32_div(rem, NSEC_PER_SEC, rate);
+}
+
+static unsigned long seccontiofs_tb_jiffies(u64 ns)
+{
+	return max_t(unsigned long, 1,
+		     usecs_to_jiffies(div_u64(ns, NSEC_PER_USEC)));
+}
+
+/*
+ * Credit @tb with the tokens accrued until @now, up to a full pool.  The
+ * stamp only moves by the time the credited tokens took, so a slow bucket
+ * keeps the fraction of a token it has already waited for, and a bucket
+ * deep in debt is paid back for all of the time it slept.
+ */
+static void seccontiofs_tb_refill(struct seccontiofs_tb *tb, u64 rate,
+				  u64 burst, u64 now)
+{
+	u64 secs, need, add;
+	u32 rem;
+
+	if (tb->pool >= (s64)burst) {
+		tb->stamp = now;
+		return;
+	}
+	need = burst - tb->pool;
+	/* split, so rate * elapsed cannot overflow however long it was */
+	secs = div_u64_rem(now - tb->stamp, NSEC_PER_SEC, &rem);
+	if (secs > div64_u64(need, rate))
+		add = need;
+	else
+		add = secs * rate + mul_u64_u32_div(rate, rem, NSEC_PER_SEC);
+	if (add >= need) {
+		tb->pool = burst;
+		tb->stamp = now;
+	} else if (add) {
+		tb->pool += add;
+		tb->stamp += seccontiofs_tb_ns(add, rate);
+	}
+}
+
+/* take @n tokens; returns the ns the caller should wait for them */
+static u64 seccontiofs_tb_charge(struct seccontiofs_tb *tb, u64 n)
+{
+	u64 rate = READ_ONCE(tb->rate);
+	u64 batch, burst, wait = 0;
+	s64 *cache;
+
+	if (!rate)
+		return 0;
+
+	cache = get_cpu_ptr(tb->cache);
+	if (*cache >= (s64)n) {
+		*cache -= n;
+		put_cpu_ptr(tb->cache);
+		return 0;
+	}
+
+	batch = max_t(u64, div64_u64(rate, SECCONTIOFS_TB_BATCH_DIV), 1);
+	burst = max_t(u64, div64_u64(rate, SECCONTIOFS_TB_BURST_DIV), batch);
+
+	spin_lock(&tb->lock);
+	seccontiofs_tb_refill(tb, rate, burst, ktime_get_ns());
+
+	tb->pool -= n - *cache;
+	*cache = 0;
+	if (tb->pool >= (s64)batch) {
+		tb->pool -= batch;
+		*cache = batch;
+	} else if (tb->pool < 0) {
+		wait = seccontiofs_tb_ns(-tb->pool, rate);
+	}
+	spin_unlock(&tb->lock);
+	put_cpu_ptr(tb->cache);
+	return wait;
+}
+
+#ifdef CONFIG_SECCONTIO_FS_SELFTEST
+/*
+ * Buckets below 10 tokens/s accrue less than one token per 100ms, the
+ * most any refill used to credit.  Put them 2s in debt and refill them
+ * every 100ms: after 2s the debt has to be paid back, to the token.
+ */
+void __init seccontiofs_throttle_selftest(void)
+{
+	struct seccontiofs_tb tb;
+	u64 rate, burst, now;
+
+	for (rate = 1; rate < SECCONTIOFS_TB_BURST_DIV; rate++) {
+		burst = max_t(u64, div64_u64(rate, SECCONTIOFS_TB_BURST_DIV), 1);
+		tb.pool = -2 * (s64)rate;
+		tb.stamp = 0;
+		for (now = 0; now <= 2 * NSEC_PER_SEC;
+		     now += NSEC_PER_SEC / SECCONTIOFS_TB_BURST_DIV)
+			seccontiofs_tb_refill(&tb, rate, burst, now);
+		WARN(tb.pool != 0,
+		     "seccontiofs: %llu tokens/s bucket left %lld after 2s\n",
+		     rate, tb.pool);
+	}
+}
+#endif
+
+static inline struct seccontiofs_throttle *
+seccontiofs_file_throttle(struct file *file)
+{
+	return &seccontiofs_SB(file_inode(file)->i_sb)->
+		throttle[seccontiofs_F(file)->slot];
+}
+
+/* ns the label of @file has to wait before @bytes more of I/O */
+u64 seccontiofs_throttle(struct file *file, size_t bytes)
+{
+	struct seccontiofs_throttle *t = seccontiofs_file_throttle(file);
+	u64 wait;
+
+	wait = max(seccontiofs_tb_charge(&t->ios, 1),
+		   seccontiofs_tb_charge(&t->bytes, bytes));
+	if (wait) {
+		percpu_counter_inc(&t->throttled);
+		percpu_counter_add(&t->wait_us, div_u64(wait, NSEC_PER_USEC));
+	}
+	return wait;
+}
+
+/* whether a nowait request of @file's label would have to wait */
+bool seccontiofs_throttle_busy(struct file *file)
+{
+	struct seccontiofs_throttle *t = seccontiofs_file_throttle(file);
+
+	return (READ_ONCE(t->ios.rate) && READ_ONCE(t->ios.pool) < 0) ||
+	       (READ_ONCE(t->bytes.rate) && READ_ONCE(t->bytes.pool) < 0);
+}
+
+int seccontiofs_throttle_wait(u64 wait)
+{
+	if (!wait)
+		return 0;
+	schedule_timeout_killable(seccontiofs_tb_jiffies(wait));
+	return fatal_signal_pending(current) ? -EINTR : 0;
+}
+
+/*
+ * Submit the label's held back requests that are due, in the order they
+ * were charged, and come back for the rest.
+ */
+static void seccontiofs_throttle_work(struct work_struct *work)
+{
+	struct seccontiofs_throttle *t =
+		container_of(to_delayed_work(work),
+			     struct seccontiofs_throttle, dwork);
+	struct seccontiofs_aio_req *req;
+	u64 now;
+
+	spin_lock(&t->lock);
+	while ((req = list_first_entry_or_null(&t->deferred,
+					       struct seccontiofs_aio_req,
+					       list))) {
+		now = ktime_get_ns();
+		if ((s64)(req->due - now) > 0) {
+			queue_delayed_work(system_unbound_wq, &t->dwork,
+				seccontiofs_tb_jiffies(req->due - now));
+			break;
+		}
+		list_del(&req->list);
+		spin_unlock(&t->lock);
+		seccontiofs_aio_submit(req);
+		spin_lock(&t->lock);
+	}
+	spin_unlock(&t->lock);
+}
+
+/* hold the async @req of @file back for @wait ns */
+void seccontiofs_throttle_defer(struct file *file,
+				struct seccontiofs_aio_req *req, u64 wait)
+{
+	struct seccontiofs_throttle *t = seccontiofs_file_throttle(file);
+	bool first;
+
+	req->due = ktime_get_ns() + wait;
+	spin_lock(&t->lock);
+	/* later ones wait behind the first, which the work is armed for */
+	first = list_empty(&t->deferred);
+	list_add_tail(&req->list, &t->deferred);
+	if (first)
+		queue_delayed_work(system_unbound_wq, &t->dwork,
+				   seccontiofs_tb_jiffies(wait));
+	spin_unlock(&t->lock);
+}
+
+void seccontiofs_set_throttle(struct super_block *sb, int slot,
+			      u64 bps, u64 iops)
+{
+	struct seccontiofs_throttle *t = &seccontiofs_SB(sb)->throttle[slot];
+
+	seccontiofs_tb_set(&t->bytes, bps);
+	seccontiofs_tb_set(&t->ios, iops);
+}
+
+/* appended to the label's line in /proc/<pid>/mountstats */
+void seccontiofs_show_throttle(struct seq_file *m, struct super_block *sb,
+			       int slot)
+{
+	struct seccontiofs_throttle *t = &seccontiofs_SB(sb)->throttle[slot];
+	u64 bps = READ_ONCE(t->bytes.rate), iops = READ_ONCE(t->ios.rate);
+	s64 throttled = percpu_counter_sum_positive(&t->throttled);
+
+	if (!bps && !iops && !throttled)
+		return;
+	seq_printf(m, " bps %llu iops %llu throttled %lld wait_us %lld",
+		   bps, iops, throttled,
+		   percpu_counter_sum_positive(&t->wait_us));
+}
+
+int seccontiofs_init_throttle(struct seccontiofs_sb_info *sbi)
+{
+	struct seccontiofs_throttle *t;
+	int i, err = 0;
+
+	for (i = 0; i < SECCONTIOFS_NR_SLOTS; i++) {
+		t = &sbi->throttle[i];
+		err = seccontiofs_tb_init(&t->bytes);
+		if (err)
+			goto out_err;
+		err = seccontiofs_tb_init(&t->ios);
+		if (err)
+			goto out_bytes;
+		err = percpu_counter_init(&t->throttled, 0, GFP_KERNEL);
+		if (err)
+			goto out_ios;
+		err = percpu_counter_init(&t->wait_us, 0, GFP_KERNEL);
+		if (err)
+			goto out_throttled;
+		spin_lock_init(&t->lock);
+		INIT_LIST_HEAD(&t->deferred);
+		INIT_DELAYED_WORK(&t->dwork, seccontiofs_throttle_work);
+	}
+	return 0;
+
+out_throttled:
+	percpu_counter_destroy(&t->throttled);
+out_ios:
+	free_percpu(t->ios.cache);
+out_bytes:
+	free_percpu(t->bytes.cache);
+out_err:
+	while (--i >= 0) {
+		t = &sbi->throttle[i];
+		percpu_counter_destroy(&t->wait_us);
+		percpu_counter_destroy(&t->throttled);
+		free_percpu(t->ios.cache);
+		free_percpu(t->bytes.cache);
+	}
+	return err;
+}
+
+void seccontiofs_destroy_throttle(struct seccontiofs_sb_info *sbi)
+{
+	struct seccontiofs_throttle *t;
+	int i;
+
+	for (i = 0; i < SECCONTIOFS_NR_SLOTS; i++) {
+		t = &sbi->throttle[i];
+		/*
+		 * Queued requests pin the mount through their files; this
+		 * waits for a worker still running after the last of them.
+		 */
+		cancel_delayed_work_sync(&t->dwork);
+		WARN_ON(!list_empty(&t->deferred));
+		percpu_counter_destroy(&t->wait_us);
+		percpu_counter_destroy(&t->throttled);
+		free_percpu(t->ios.cache);
+		free_percpu(t->bytes.cache);
+	}
+}